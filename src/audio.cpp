@@ -1,16 +1,16 @@
 #include "audio.h"
+#include "audio_sink.h"
+#include "profiler.h"
+#include "state.h"
+#include <algorithm>
+#include <array>
+#include <vector>
 #include <iostream>
 #include "fmt/core.h"
 
-#include <unistd.h>
-#include <fcntl.h>
-#include "gui.h"
-
 namespace gb {
 
 namespace {
-    const uint32_t sampleRate = 48000;
-
     constexpr std::array<std::array<int, 8>, 4> dutyCycles{{
         { 0, 0, 0, 0, 0, 0, 0, 1 }, // 12.5%
         { 1, 0, 0, 0, 0, 0, 0, 1 }, // 25%
@@ -18,37 +18,6 @@ namespace {
         { 0, 1, 1, 1, 1, 1, 1, 0 }, // 75%
     }};
 
-    template<typename T> void Store(int fd, T value)
-    {
-        write(fd, &value, sizeof(value));
-    }
-
-    int MakeWav()
-    {
-        int fd = open("/tmp/out.wav", O_CREAT | O_WRONLY | O_TRUNC, 0644);
-#if 1
-        const uint16_t bitsPerSample = 16;
-        const uint16_t numChannels = 2;
-        const uint32_t byteRate = sampleRate * numChannels * (bitsPerSample / 2);
-        const uint16_t blockAlign = numChannels * (bitsPerSample / 8);
-
-        write(fd, "RIFF", 4);
-        if (uint32_t fileSize = 0xffffffff; true) Store(fd, fileSize);
-        write(fd, "WAVE", 4);
-        write(fd, "fmt ", 4);
-        if (uint32_t len = 16; true) Store(fd, len);
-        if (uint16_t type = 1; true) Store(fd, type);
-        Store(fd, numChannels);
-        Store(fd, sampleRate);
-        Store(fd, byteRate);
-        Store(fd, blockAlign);
-        Store(fd, bitsPerSample);
-        write(fd, "data", 4);
-        if (uint32_t dataSize = 0xffffffff; true) Store(fd, dataSize);
-#endif
-        return fd;
-    }
-
     std::string IORegisterToString(const Address address) {
         switch(address) {
             case io::NR10: return "NR10 [square1: sweep period, negate, shift]";
@@ -93,7 +62,9 @@ namespace {
     }
 
     constexpr int TimerDivisor = 8192; // 4MHz / 8192 = 512Hz timer
-    constexpr int SampleTimerReload = 4'194'304 / sampleRate;
+    constexpr int SampleTimerReload = 4'194'304 / Audio::SampleRate;
+    // Samples are synthesized lazily; this bounds the output latency
+    constexpr Cycle BlockCycles = 512 * SampleTimerReload;
 
     constexpr int FrequenceToPeriod(const int freq)
     {
@@ -135,8 +106,6 @@ namespace {
     }
 }
 
-int fd = -1;
-
 struct Audio::Impl
 {
     uint8_t& Register(const Address address)
@@ -149,14 +118,11 @@ struct Audio::Impl
         return IsBitSet<7>(Register(io::NR52));
     }
 
-    Impl()
+    Impl(Scheduler& scheduler)
+        : scheduler(scheduler)
     {
         sampleTimer = SampleTimerReload;
-    }
-
-    ~Impl()
-    {
-        if (fd >= 0) close(fd);
+        scheduler.Schedule(event::Audio, BlockCycles);
     }
 
     void TickLengthCounter()
@@ -204,67 +170,140 @@ struct Audio::Impl
                 ch.sweepFrequency = newFreq;
                 ch.frequency = newFreq;
                 ch.periodTimer = FrequenceToPeriod(ch.frequency);
-                if (CalculateSweep(2047) > 2047)
+                if (CalculateSweep(ch) > 2047)
                     ch.enabled = false;
             }
         }
     }
 
-    void TickChannels()
+    // Advances the square wave generators analytically: instead of counting
+    // down every clock cycle, all whole periods that fit are applied at once
+    void AdvanceChannels(const int cycles)
     {
         for(auto& ch: channel) {
-            --ch.periodTimer;
-            if (ch.periodTimer == 0) {
-                ch.currentDutyCycle = (ch.currentDutyCycle + 1) % 8;
-                ch.periodTimer = FrequenceToPeriod(ch.frequency);
+            if (!ch.enabled) continue;
+            ch.periodTimer -= cycles;
+            if (ch.periodTimer <= 0) {
+                const int period = FrequenceToPeriod(ch.frequency);
+                const int steps = 1 + (-ch.periodTimer / period);
+                ch.currentDutyCycle = (ch.currentDutyCycle + steps) % 8;
+                ch.periodTimer += steps * period;
             }
         }
     }
 
-    void Tick(IO& io, Memory& memory, const int cycles)
+    void TickFrameSequencer()
     {
-        for (int n = 0; n < cycles; ++n)
-            TickChannels();
-
-        cycleCounter += cycles;
-        if (cycleCounter >= TimerDivisor) {
-            cycleCounter -= TimerDivisor;
-            if (step == 0 || step == 2 || step == 4 || step == 6)
-                TickLengthCounter();
-            if (step == 2 || step == 6)
-                TickSweep();
-            if (step == 7)
-                TickVolumeEnvelope();
-            step = (step + 1) % 8;
-        }
+        if (step == 0 || step == 2 || step == 4 || step == 6)
+            TickLengthCounter();
+        if (step == 2 || step == 6)
+            TickSweep();
+        if (step == 7)
+            TickVolumeEnvelope();
+        step = (step + 1) % 8;
+    }
 
-        sampleTimer -= cycles;
-        if (sampleTimer <= 0) {
-            sampleTimer = SampleTimerReload;
-            int16_t left{}, right{};
-            for (size_t chNum = 0; chNum < channel.size(); ++chNum) {
-                const int v = channel[chNum].GetSample();
-                if (outputLeft[chNum]) left += v;
-                if (outputRight[chNum]) right += v;
-            }
-            left *= masterVolumeLeft * 8;
-            right *= masterVolumeRight * 8;
+    bool IsAnyChannelEnabled() const
+    {
+        return std::any_of(channel.begin(), channel.end(), [](const auto& ch) { return ch.enabled; });
+    }
 
-            static bool first = true;
-            if (first) {
-                first = false;
-                fd = MakeWav();
+    void EmitSample()
+    {
+        int16_t left{}, right{};
+        for (size_t chNum = 0; chNum < channel.size(); ++chNum) {
+            const int v = channel[chNum].GetSample();
+            if (outputLeft[chNum]) left += v;
+            if (outputRight[chNum]) right += v;
+        }
+        left *= masterVolumeLeft * 8;
+        right *= masterVolumeRight * 8;
+        samples.push_back(left);
+        samples.push_back(right);
+    }
+
+    void Advance(Cycle cycles)
+    {
+        while (cycles > 0 || cycleCounter >= TimerDivisor) {
+            if (!IsAnyChannelEnabled()) {
+                // Nothing audible: skip straight to the next frame sequencer
+                // step, the samples in between are all silent
+                const auto chunk = std::min<Cycle>(cycles, TimerDivisor - cycleCounter);
+                const auto numSamples = (chunk + SampleTimerReload - sampleTimer) / SampleTimerReload;
+                samples.resize(samples.size() + 2 * numSamples);
+                sampleTimer = SampleTimerReload - static_cast<int>((chunk + SampleTimerReload - sampleTimer) % SampleTimerReload);
+                cycleCounter += chunk;
+                cycles -= chunk;
+            } else {
+                const auto chunk = std::min<Cycle>({ cycles, static_cast<Cycle>(sampleTimer), static_cast<Cycle>(TimerDivisor - cycleCounter) });
+                AdvanceChannels(chunk);
+                cycleCounter += chunk;
+                cycles -= chunk;
+                sampleTimer -= chunk;
+                if (sampleTimer == 0) {
+                    sampleTimer = SampleTimerReload;
+                    EmitSample();
+                }
             }
 
-            if (fd >= 0) {
-                write(fd, &left, sizeof(left)); 
-                write(fd, &right, sizeof(right)); 
+            if (cycleCounter >= TimerDivisor) {
+                cycleCounter -= TimerDivisor;
+                TickFrameSequencer();
             }
         }
     }
 
+    void Sync()
+    {
+        if (scheduler.now == lastSync) return;
+        ScopedTimer timer(profiler, subsystem::Audio);
+        Advance(scheduler.now - lastSync);
+        lastSync = scheduler.now;
+        scheduler.Schedule(event::Audio, scheduler.now + BlockCycles);
+
+        if (samples.empty()) return;
+        if (sink)
+            sink->Write(samples.data(), samples.size());
+        samples.clear();
+    }
+
+    // Pending samples are flushed to the sink by Sync(), so these need
+    // not be stored
+    void SaveState(state::Writer& writer)
+    {
+        Sync();
+        writer.Write(lastSync);
+        writer.Write(channel);
+        writer.Write(outputLeft);
+        writer.Write(outputRight);
+        writer.Write(masterVolumeLeft);
+        writer.Write(masterVolumeRight);
+        writer.Write(data);
+        writer.Write(audioEnabled);
+        writer.Write(cycleCounter);
+        writer.Write(step);
+        writer.Write(sampleTimer);
+    }
+
+    void LoadState(state::Reader& reader)
+    {
+        samples.clear();
+        reader.Read(lastSync);
+        reader.Read(channel);
+        reader.Read(outputLeft);
+        reader.Read(outputRight);
+        reader.Read(masterVolumeLeft);
+        reader.Read(masterVolumeRight);
+        reader.Read(data);
+        reader.Read(audioEnabled);
+        reader.Read(cycleCounter);
+        reader.Read(step);
+        reader.Read(sampleTimer);
+    }
+
     uint8_t Read(const Address address)
     {
+        Sync();
         constexpr std::array<uint8_t, io::NR52 - io::NR10 + 1> registerOrMask{
             0x80, 0x3f, 0x00, 0xff, 0xbf, // NR10..NR14
             0xff, 0x3f, 0x00, 0xff, 0xbf, // NR20..NR24
@@ -275,15 +314,17 @@ struct Audio::Impl
         uint8_t value = Register(address);
         if (address >= 0xff27 && address <= 0xff2f)
             value = 0xff;
-        else {
+        else if (address <= io::NR52) {
             value = value | registerOrMask[address - io::NR10];
         }
-        std::cout << fmt::format("audio: read {} ({:x}): {:x}\n", IORegisterToString(address), address, value);
+        if (enableTracing)
+            std::cout << fmt::format("audio: read {} ({:x}): {:x}\n", IORegisterToString(address), address, value);
         return value;
     }
 
     void Write(const Address address, uint8_t value)
     {
+        Sync();
         if (address == io::NR52) {
             const bool nextEnabled = IsBitSet<7>(value);
             if (!audioEnabled && nextEnabled) {
@@ -291,13 +332,18 @@ struct Audio::Impl
                 cycleCounter = TimerDivisor;
                 step = 0;
             }
+            if (!nextEnabled) {
+                for(auto& ch: channel)
+                    ch.enabled = false;
+            }
             audioEnabled = nextEnabled;
             Register(address) = value & 0x80;
             return;
         }
 
         if (!IsEnabled()) {
-            std::cout << fmt::format("Audio: ignoring write of address{:4} value {:2x}, sound disabled", address, value);
+            if (enableTracing)
+                std::cout << fmt::format("audio: ignoring write of address {:4x} value {:2x}, sound disabled\n", address, value);
             return;
         }
 
@@ -368,10 +414,18 @@ struct Audio::Impl
                 outputRight[0] = IsBitSet<0>(value);
                 break;
         }
-        std::cout << fmt::format("audio: write {} ({:x}): {:x}\n", IORegisterToString(address), address, value);
+        if (enableTracing)
+            std::cout << fmt::format("audio: write {} ({:x}): {:x}\n", IORegisterToString(address), address, value);
         Register(address) = value;
     }
 
+    Scheduler& scheduler;
+    Cycle lastSync{};
+    std::vector<int16_t> samples;
+    std::shared_ptr<AudioSink> sink;
+    Profiler* profiler{};
+    bool enableTracing{};
+
     std::array<Channel, 3> channel{};
 
     std::array<bool, 4> outputLeft{};
@@ -388,16 +442,41 @@ struct Audio::Impl
     int sampleTimer{};
 };
 
-Audio::Audio()
-    : impl(std::make_unique<Audio::Impl>())
+Audio::Audio(Scheduler& scheduler)
+    : impl(std::make_unique<Audio::Impl>(scheduler))
 {
 }
 
 Audio::~Audio() = default;
 
-void Audio::Tick(IO& io, Memory& memory, const int cycles)
+void Audio::Sync()
+{
+    impl->Sync();
+}
+
+void Audio::SetSink(std::shared_ptr<AudioSink> sink)
+{
+    impl->sink = std::move(sink);
+}
+
+void Audio::SetProfiler(Profiler* profiler)
+{
+    impl->profiler = profiler;
+}
+
+void Audio::SaveState(state::Writer& writer)
+{
+    impl->SaveState(writer);
+}
+
+void Audio::LoadState(state::Reader& reader)
+{
+    impl->LoadState(reader);
+}
+
+void Audio::SetTracing(const bool enabled)
 {
-    impl->Tick(io, memory, cycles);
+    impl->enableTracing = enabled;
 }
 
 uint8_t Audio::Read(const Address address)
@@ -1,22 +1,38 @@
 #pragma once
 
 #include <memory>
+#include "scheduler.h"
 #include "types.h"
 
 namespace gb {
 
-struct IO;
-struct Memory;
+class AudioSink;
+struct Profiler;
+namespace state { class Reader; class Writer; }
 
 class Audio
 {
 public:
-    Audio();
+    static constexpr uint32_t SampleRate = 48000;
+
+    Audio(Scheduler& scheduler);
     ~Audio();
 
-    void Tick(IO& io, Memory& memory, const int cycles);
+    // Synthesizes all samples up to the current clock cycle. This happens
+    // whenever the event::Audio deadline passes and before any register
+    // access
+    void Sync();
     uint8_t Read(const Address address);
     void Write(const Address address, const uint8_t value);
+    // The sink receives every completed block of samples; without one,
+    // the samples are discarded
+    void SetSink(std::shared_ptr<AudioSink> sink);
+    // Accounts the time spent synthesizing to the profiler, if not nullptr
+    void SetProfiler(Profiler* profiler);
+    // Syncs first, so the snapshot is at the current clock cycle
+    void SaveState(state::Writer& writer);
+    void LoadState(state::Reader& reader);
+    void SetTracing(const bool enabled);
 
 private:
     struct Impl;
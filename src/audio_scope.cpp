@@ -0,0 +1,33 @@
+#include "audio_scope.h"
+
+#include <cstdlib>
+
+namespace gb {
+
+AudioScope::AudioScope(std::shared_ptr<AudioSink> next)
+    : next(std::move(next))
+{
+}
+
+void AudioScope::Write(const int16_t* samples, const size_t count)
+{
+    if (next)
+        next->Write(samples, count);
+
+    for (size_t n = 0; n + 1 < count; n += 2) {
+        for (size_t ch = 0; ch < peak.size(); ++ch) {
+            if (std::abs(samples[n + ch]) > std::abs(peak[ch]))
+                peak[ch] = samples[n + ch];
+        }
+        if (++pendingSamples < Decimation)
+            continue;
+        for (size_t ch = 0; ch < peak.size(); ++ch) {
+            ring.channels[ch][ring.offset] = peak[ch] / 32768.0f;
+            peak[ch] = 0;
+        }
+        ring.offset = (ring.offset + 1) % Length;
+        pendingSamples = 0;
+    }
+}
+
+}
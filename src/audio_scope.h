@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include "audio_sink.h"
+
+namespace gb {
+
+// Passes the audio on to another sink, keeping the most recent samples,
+// decimated, for display. The points form a ring per channel: a copy of
+// the snapshot can be plotted from offset on, without reordering it
+class AudioScope : public AudioSink
+{
+public:
+    static constexpr size_t Length = 1024;
+    // Samples per point, so the scope shows about 0.17 s
+    static constexpr size_t Decimation = 8;
+
+    struct Snapshot {
+        // Left and right, from -1 to 1
+        std::array<std::array<float, Length>, 2> channels{};
+        // The oldest point
+        int offset{};
+    };
+
+    // next may be nullptr
+    explicit AudioScope(std::shared_ptr<AudioSink> next);
+
+    void Write(const int16_t* samples, const size_t count) override;
+
+    // Not synchronized: call it on the thread that feeds the sink
+    const Snapshot& GetSnapshot() const { return ring; }
+
+private:
+    std::shared_ptr<AudioSink> next;
+    Snapshot ring;
+    // Every point is the sample of the largest magnitude among those it
+    // stands for, so short peaks remain visible
+    std::array<int, 2> peak{};
+    size_t pendingSamples{};
+};
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gb {
+
+// Receives the synthesized audio as blocks of interleaved 16-bit stereo
+// samples at Audio::SampleRate. Write() is called from the emulation
+// thread and must never block on I/O
+class AudioSink
+{
+public:
+    virtual ~AudioSink() = default;
+    virtual void Write(const int16_t* samples, const size_t count) = 0;
+};
+
+class NullAudioSink : public AudioSink
+{
+public:
+    void Write(const int16_t*, const size_t) override { }
+};
+
+}
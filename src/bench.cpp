@@ -0,0 +1,236 @@
+#include "cartridge.h"
+#include "profiler.h"
+#include "system.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+#include "fmt/core.h"
+
+namespace {
+
+// Clock of the real hardware, in cycles per second
+constexpr double HardwareClock = 4'194'304.0;
+
+long optionFrames = 3000;
+bool optionBootROM = false;
+bool optionBundledROMs = true;
+std::string optionJSONPath;
+std::string optionBundledROMPath = GBEMU_TEST_ROM_DIR;
+std::vector<std::string> romPaths;
+
+bool ProcessOptions(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "h?bxf:o:d:")) != -1) {
+        switch(opt) {
+            case 'h':
+            case '?':
+                std::cout << fmt::format("usage: {} [-h?bx] [-f frames] [-o results.json] [-d directory] [cartridge.gb ...]\n\n", argv[0]);
+                std::cout << fmt::format("  -h, -?     this help\n");
+                std::cout << fmt::format("  -b         enable bootrom emulation\n");
+                std::cout << fmt::format("  -x         do not run the bundled test ROMs\n");
+                std::cout << fmt::format("  -f frames  number of frames to run every cartridge for (default: {})\n", optionFrames);
+                std::cout << fmt::format("  -o file    write the results to file (JSON)\n");
+                std::cout << fmt::format("  -d dir     location of the bundled test ROMs (default: {})\n\n", optionBundledROMPath);
+                std::cout << fmt::format("Every *.gb file below the bundled ROM directory is run, followed by the\n");
+                std::cout << fmt::format("cartridges given on the command line.\n");
+                return false;
+            case 'b':
+                optionBootROM = true;
+                break;
+            case 'x':
+                optionBundledROMs = false;
+                break;
+            case 'f':
+                optionFrames = std::stol(optarg);
+                break;
+            case 'o':
+                optionJSONPath = optarg;
+                break;
+            case 'd':
+                optionBundledROMPath = optarg;
+                break;
+        }
+    }
+
+    if (optionFrames <= 0) {
+        std::cout << fmt::format("expected a positive number of frames\n");
+        return false;
+    }
+
+    if (optionBundledROMs) {
+        std::vector<std::string> bundled;
+        std::error_code ec;
+        for(const auto& entry: std::filesystem::recursive_directory_iterator(optionBundledROMPath, ec)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".gb")
+                bundled.push_back(entry.path().string());
+        }
+        if (ec) {
+            std::cout << fmt::format("cannot scan '{}': {}\n", optionBundledROMPath, ec.message());
+            return false;
+        }
+        std::sort(bundled.begin(), bundled.end());
+        romPaths = std::move(bundled);
+    }
+    for(int n = optind; n < argc; ++n)
+        romPaths.push_back(argv[n]);
+
+    if (romPaths.empty()) {
+        std::cout << fmt::format("no cartridges to run\n");
+        return false;
+    }
+    return true;
+}
+
+struct Result {
+    std::string romPath;
+    long frames{};
+    long long cycles{};
+    double seconds{};
+    std::array<double, gb::subsystem::NumberOfTypes> subsystemSeconds{};
+    size_t stateBytes{};
+    double saveStateSeconds{};
+    double loadStateSeconds{};
+};
+
+double ToSeconds(const gb::Profiler::Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+Result Run(const std::string& romPath)
+{
+    Result result;
+    result.romPath = romPath;
+
+    gb::System system(gb::LoadROM(romPath));
+    gb::Profiler profiler;
+    system.SetProfiler(&profiler);
+    system.Reset(optionBootROM);
+
+    const auto start = gb::Profiler::Clock::now();
+    while(result.frames < optionFrames) {
+        result.cycles += system.Run(gb::System::CyclesPerFrame);
+        if (system.video.GetRenderFlagAndReset())
+            ++result.frames;
+    }
+    const auto total = gb::Profiler::Clock::now() - start;
+
+    // Everything not spent in a device is attributed to the CPU
+    auto cpu = total;
+    for(int n = 0; n < gb::subsystem::NumberOfTypes; ++n) {
+        if (n == gb::subsystem::CPU) continue;
+        cpu -= profiler.time[n];
+        result.subsystemSeconds[n] = ToSeconds(profiler.time[n]);
+    }
+    result.subsystemSeconds[gb::subsystem::CPU] = std::max(0.0, ToSeconds(cpu));
+    result.seconds = ToSeconds(total);
+
+    // Snapshot the final state repeatedly, as checkpointing every frame would
+    constexpr int StateIterations = 100;
+    std::vector<uint8_t> state;
+    const auto saveStart = gb::Profiler::Clock::now();
+    for(int n = 0; n < StateIterations; ++n)
+        system.SaveState(state);
+    const auto loadStart = gb::Profiler::Clock::now();
+    for(int n = 0; n < StateIterations; ++n)
+        system.LoadState(state);
+    const auto loadEnd = gb::Profiler::Clock::now();
+    result.stateBytes = state.size();
+    result.saveStateSeconds = ToSeconds(loadStart - saveStart) / StateIterations;
+    result.loadStateSeconds = ToSeconds(loadEnd - loadStart) / StateIterations;
+    return result;
+}
+
+std::string EscapeJSON(const std::string& s)
+{
+    std::string result;
+    for(const char ch: s) {
+        switch(ch) {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            default:
+                if (static_cast<unsigned char>(ch) < 0x20)
+                    result += fmt::format("\\u{:04x}", ch);
+                else
+                    result += ch;
+        }
+    }
+    return result;
+}
+
+void WriteJSON(std::ostream& os, const std::vector<Result>& results)
+{
+    long long totalCycles = 0;
+    double totalSeconds = 0;
+    os << "{\n";
+    os << fmt::format("  \"frames\": {},\n", optionFrames);
+    os << "  \"results\": [\n";
+    for(size_t n = 0; n < results.size(); ++n) {
+        const auto& r = results[n];
+        const auto cyclesPerSecond = r.cycles / r.seconds;
+        os << "    {\n";
+        os << fmt::format("      \"rom\": \"{}\",\n", EscapeJSON(r.romPath));
+        os << fmt::format("      \"frames\": {},\n", r.frames);
+        os << fmt::format("      \"cycles\": {},\n", r.cycles);
+        os << fmt::format("      \"seconds\": {:.6f},\n", r.seconds);
+        os << fmt::format("      \"cycles_per_second\": {:.0f},\n", cyclesPerSecond);
+        os << fmt::format("      \"frames_per_second\": {:.2f},\n", r.frames / r.seconds);
+        os << fmt::format("      \"speed\": {:.3f},\n", cyclesPerSecond / HardwareClock);
+        os << "      \"time\": {";
+        os << fmt::format(" \"cpu\": {:.6f},", r.subsystemSeconds[gb::subsystem::CPU]);
+        os << fmt::format(" \"video\": {:.6f},", r.subsystemSeconds[gb::subsystem::Video]);
+        os << fmt::format(" \"audio\": {:.6f},", r.subsystemSeconds[gb::subsystem::Audio]);
+        os << fmt::format(" \"io\": {:.6f} }},\n", r.subsystemSeconds[gb::subsystem::IO]);
+        os << fmt::format("      \"state\": {{ \"bytes\": {}, \"save\": {:.9f}, \"load\": {:.9f} }}\n", r.stateBytes, r.saveStateSeconds, r.loadStateSeconds);
+        os << (n + 1 < results.size() ? "    },\n" : "    }\n");
+        totalCycles += r.cycles;
+        totalSeconds += r.seconds;
+    }
+    os << "  ],\n";
+    os << "  \"total\": {\n";
+    os << fmt::format("    \"cycles\": {},\n", totalCycles);
+    os << fmt::format("    \"seconds\": {:.6f},\n", totalSeconds);
+    os << fmt::format("    \"cycles_per_second\": {:.0f},\n", totalCycles / totalSeconds);
+    os << fmt::format("    \"speed\": {:.3f}\n", totalCycles / totalSeconds / HardwareClock);
+    os << "  }\n";
+    os << "}\n";
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    if (!ProcessOptions(argc, argv)) return 1;
+
+    // Machines run one after another, so they do not compete for the CPU
+    std::vector<Result> results;
+    for(const auto& path: romPaths) {
+        try {
+            results.push_back(Run(path));
+        } catch (std::exception& e) {
+            std::cerr << fmt::format("{}: {}\n", path, e.what());
+            return 1;
+        }
+        const auto& r = results.back();
+        const auto& t = r.subsystemSeconds;
+        std::cerr << fmt::format("{}: {:.3f}s, {:.1f}x real time (cpu {:.3f}s, video {:.3f}s, audio {:.3f}s, io {:.3f}s), state {} bytes (save {:.1f}us, load {:.1f}us)\n",
+            path, r.seconds, r.cycles / r.seconds / HardwareClock,
+            t[gb::subsystem::CPU], t[gb::subsystem::Video], t[gb::subsystem::Audio], t[gb::subsystem::IO],
+            r.stateBytes, r.saveStateSeconds * 1e6, r.loadStateSeconds * 1e6);
+    }
+
+    if (!optionJSONPath.empty()) {
+        std::ofstream ofs(optionJSONPath);
+        WriteJSON(ofs, results);
+        if (!ofs) {
+            std::cerr << fmt::format("cannot write '{}'\n", optionJSONPath);
+            return 1;
+        }
+    }
+    return 0;
+}
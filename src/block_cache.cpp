@@ -0,0 +1,110 @@
+#include "block_cache.h"
+#include "cpu.h"
+
+namespace gb {
+
+namespace {
+    constexpr bool StartsWith(const std::string_view s, const std::string_view prefix)
+    {
+        return s.substr(0, prefix.size()) == prefix;
+    }
+
+    // Derived from the mnemonics so it cannot drift from the opcode table
+    constexpr std::array<bool, 256> endsBlock = []() {
+        std::array<bool, 256> result{};
+        for (size_t n = 0; n < result.size(); ++n) {
+            const auto name = cpu::opcode[n].name;
+            result[n] =
+                StartsWith(name, "jp") || StartsWith(name, "jr") ||
+                StartsWith(name, "call") || StartsWith(name, "ret") ||
+                StartsWith(name, "rst") || StartsWith(name, "halt") ||
+                StartsWith(name, "stop") || StartsWith(name, "<");
+        }
+        return result;
+    }();
+
+    constexpr int GetArgumentLength(const cpu::Argument arg)
+    {
+        switch(arg) {
+            case cpu::Argument::None: return 0;
+            case cpu::Argument::Imm8: return 1;
+            case cpu::Argument::Rel8: return 1;
+            case cpu::Argument::Imm16: return 2;
+        }
+        return 0;
+    }
+
+    constexpr bool IsCacheable(const Address address)
+    {
+        // External RAM is written through the fast path, so writes to it
+        // cannot be tracked; VRAM is left out as code never runs there
+        return address <= memory_map::Cartridge0End ||
+            (address >= memory_map::WRAM0Start && address <= memory_map::MirrorEnd);
+    }
+}
+
+BlockCache::BlockCache(Memory& memory)
+    : memory(memory)
+{
+    for (int page = 0; page < Memory::NumberOfPages; ++page)
+        isCacheable[page] = IsCacheable(page << Memory::PageShift);
+}
+
+BlockCache::PageBlocks& BlockCache::GetPage(const uint8_t* host)
+{
+    auto& blocks = pages[host];
+    if (!blocks)
+        blocks = std::make_unique<PageBlocks>();
+    return *blocks;
+}
+
+std::unique_ptr<Block> BlockCache::Decode(const Address pc)
+{
+    auto block = std::make_unique<Block>();
+    const int pageEnd = (pc | Memory::PageMask) + 1;
+    int address = pc;
+    while (block->instructions.size() < MaxBlockLength) {
+        DecodedInstruction instruction{ memory.At_u8(address), false, 1, 0 };
+        if (instruction.opcode == 0xcb) {
+            instruction.prefixed = true;
+            instruction.length = 2;
+        } else {
+            instruction.length += GetArgumentLength(cpu::opcode[instruction.opcode].arg);
+        }
+        // Instructions straddling a page may straddle a ROM bank as well
+        if (address + instruction.length > pageEnd)
+            break;
+        if (instruction.prefixed)
+            instruction.opcode = memory.At_u8(address + 1);
+        else if (instruction.length >= 2)
+            instruction.operand = memory.At_u8(address + 1);
+        if (!instruction.prefixed && instruction.length == 3)
+            instruction.operand |= memory.At_u8(address + 2) << 8;
+        block->instructions.push_back(instruction);
+        address += instruction.length;
+        if (!instruction.prefixed && endsBlock[instruction.opcode])
+            break;
+    }
+
+    if (!block->instructions.empty() && pc >= memory_map::WRAM0Start)
+        memory.TrackCode(pc);
+    return block;
+}
+
+void BlockCache::InvalidatePage(const Address base)
+{
+    const auto host = &memory.data[base];
+    pages.erase(host);
+    for (auto& mapped: mappedPage) {
+        if (mapped.host == host)
+            mapped = {};
+    }
+}
+
+void BlockCache::Clear()
+{
+    pages.clear();
+    mappedPage.fill({});
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "memory.h"
+#include "types.h"
+
+namespace gb {
+
+struct DecodedInstruction {
+    uint8_t opcode;
+    bool prefixed; // opcode indexes opcode_cb[]
+    uint8_t length;
+    // The immediate (8 or 16 bits), resolved when decoding, see
+    // cpu::DispatchImmediate()
+    uint16_t operand;
+};
+
+// Straight-line run of instructions, ending at the first jump, call,
+// return, halt or stop or at the end of the 256-byte page
+struct Block {
+    std::vector<DecodedInstruction> instructions;
+};
+
+// Pre-decoded blocks of code, keyed on the host memory that holds them.
+// ROM code thus stays valid across bank switches (each bank is a different
+// key), and writes to RAM holding decoded code are trapped by Memory,
+// which then drops the blocks of that page through InvalidatePage()
+class BlockCache
+{
+public:
+    static constexpr size_t MaxBlockLength = 64;
+
+    explicit BlockCache(Memory& memory);
+
+    BlockCache(const BlockCache&) = delete;
+    BlockCache& operator=(const BlockCache&) = delete;
+
+    // Returns the block starting at pc, decoding it first if needed, or
+    // nullptr if the code there is not cacheable (I/O, HRAM, external RAM,
+    // the bootstrap ROM, ...)
+    const Block* Lookup(const Address pc)
+    {
+        const auto page = pc >> Memory::PageShift;
+        const auto host = memory.GetPagePointer(page);
+        if (host == nullptr || !isCacheable[page])
+            return nullptr;
+        auto& mapped = mappedPage[page];
+        if (mapped.host != host)
+            mapped = { host, &GetPage(host) };
+        auto& block = (*mapped.blocks)[pc & Memory::PageMask];
+        if (!block)
+            block = Decode(pc);
+        return block->instructions.empty() ? nullptr : block.get();
+    }
+
+    // Drops all blocks decoded from the page of memory.data at base
+    void InvalidatePage(const Address base);
+    void Clear();
+
+private:
+    using PageBlocks = std::array<std::unique_ptr<Block>, 1 << Memory::PageShift>;
+    struct MappedPage {
+        const uint8_t* host{};
+        PageBlocks* blocks{};
+    };
+
+    PageBlocks& GetPage(const uint8_t* host);
+    std::unique_ptr<Block> Decode(const Address pc);
+
+    Memory& memory;
+    std::array<bool, Memory::NumberOfPages> isCacheable{};
+    std::unordered_map<const uint8_t*, std::unique_ptr<PageBlocks>> pages;
+    // Last host page seen for every CPU page, to avoid hashing on every lookup
+    std::array<MappedPage, Memory::NumberOfPages> mappedPage{};
+};
+
+}
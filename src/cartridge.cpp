@@ -1,33 +1,22 @@
 #include "cartridge.h"
+#include "state.h"
+#include <algorithm>
 #include <array>
 #include <iostream>
-#include <fstream>
-#include <vector>
+#include <stdexcept>
 #include "fmt/core.h"
 
-namespace gb::cartridge {
+namespace gb {
 
 namespace {
-    std::array<uint8_t, 8192> externalRAM;
-    bool externalRamEnabled = false;
-    bool enableTracing = false;
-    int currentRomBank = 1;
-    std::vector<uint8_t> cartridgeData;
+    // Indexed by the RAM size in the header (0x149)
+    constexpr std::array<size_t, 6> ramSizes{ 0, 2048, 8192, 32768, 131072, 65536 };
+    constexpr size_t MBC2RAMSize = 512;
 }
 
-void SetTracing(const bool enabled)
+Cartridge::Cartridge(const Scheduler& scheduler, std::shared_ptr<const ROM> rom)
+    : rom(std::move(rom)), cartridgeData(*this->rom)
 {
-    enableTracing = enabled;
-}
-
-
-void Load(const std::string& path)
-{
-    {
-        std::ifstream ifs(path);
-        ifs >> std::noskipws;
-        std::copy(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>(), std::back_inserter(cartridgeData));
-    }
     if (cartridgeData.size() < 16384)
         throw std::runtime_error("cartridge file too short");
 
@@ -35,67 +24,164 @@ void Load(const std::string& path)
     const auto cartridgeROMSize = cartridgeData[0x148];
     const auto cartridgeRAMSize = cartridgeData[0x149];
     std::cout << fmt::format("cartridge type {:x} rom size {:x} ram size {:x}\n", cartridgeType, cartridgeROMSize, cartridgeRAMSize);
-    if (cartridgeType != 1 && cartridgeType != 0)
-        throw std::runtime_error("only MBC1 supported");
+    const auto supportedType = mapper::GetCartridgeType(cartridgeType);
+    if (!supportedType)
+        throw std::runtime_error(fmt::format("unsupported cartridge type {:02x}", cartridgeType));
+    type = *supportedType;
+    mapper = mapper::Create(type, scheduler);
+
+    // Without any RAM declared, 8 KiB is provided regardless: test ROMs
+    // tend to report their results there
+    size_t ramSize = cartridgeRAMSize < ramSizes.size() ? ramSizes[cartridgeRAMSize] : 0;
+    if (type.kind == mapper::Kind::MBC2)
+        ramSize = MBC2RAMSize;
+    else if (ramSize == 0)
+        ramSize = Mapper::RAMBankSize;
+    ownRAM.resize(ramSize);
+    externalRAM = ownRAM.data();
+    this->ramSize = ramSize;
+    dirtyRAMPage.resize((ramSize + RAMPageSize - 1) / RAMPageSize);
+    ramMask = std::min(ramSize, Mapper::RAMBankSize) - 1;
+    // The bank numbers wrap around at the size of the ROM
+    numberOfROMBanks = (cartridgeData.size() + Mapper::ROMBankSize - 1) / Mapper::ROMBankSize;
+    UpdateMapping();
 }
 
-uint8_t Read_u8(const Address address)
+void Cartridge::AttachSaveFile(const std::string& path)
 {
-    if (address >= 0x0000 && address <= 0x3fff)
-        return cartridgeData[address];
-    if (address >= 0x4000 && address <= 0x7fff) {
-        const Address addr = (address - 0x4000) + currentRomBank * 16384;
-        return cartridgeData[addr];
+    saveFile = std::make_unique<SaveFile>(path, ramSize);
+    externalRAM = saveFile->data();
+    ownRAM = {};
+}
+
+void Cartridge::FlushSaveFile()
+{
+    if (saveFile)
+        saveFile->Flush();
+}
+
+void Cartridge::SetTracing(const bool enabled)
+{
+    enableTracing = enabled;
+}
+
+bool Cartridge::UpdateMapping()
+{
+    const auto& mapping = mapper->GetMapping();
+    const std::array<size_t, 2> rom{
+        (mapping.rom0 % numberOfROMBanks) * Mapper::ROMBankSize,
+        (mapping.rom1 % numberOfROMBanks) * Mapper::ROMBankSize
+    };
+    const size_t ram = (mapping.ram * Mapper::RAMBankSize) % ramSize;
+    const bool accessible = mapping.ramEnabled && !mapping.registerSelected;
+    const bool changed = rom != romOffset || ram != ramOffset || accessible != ramAccessible;
+    romOffset = rom;
+    ramOffset = ram;
+    ramAccessible = accessible;
+    return changed;
+}
+
+const uint8_t* Cartridge::GetReadPointer(const Address address)
+{
+    if (address <= 0x7fff) {
+        const size_t offset = romOffset[address >> 14] + (address & 0x3fff);
+        if (offset >= cartridgeData.size()) return nullptr;
+        return &cartridgeData[offset];
     }
 
     if (address >= 0xa000 && address <= 0xbfff) {
-        if (!externalRamEnabled && enableTracing) {
-            std::cout << fmt::format("cartridge: ignoring read from address {:04x}, extram disabled\n", address);
-            return 0xff;
-        }
-        return externalRAM[address - 0xa000];
+        if (!ramAccessible) return nullptr;
+        return &externalRAM[ramOffset + ((address - 0xa000) & ramMask)];
     }
+    return nullptr;
+}
 
-    std::cout << fmt::format("cartridge: ignoring read from address {:04x}, unmapped\n", address);
-    return 0xff;
+void Cartridge::SaveState(state::Writer& writer) const
+{
+    mapper->SaveState(writer);
+    writer.WriteRegion(externalRAM, ramSize);
 }
 
-void Write_u8(const Address address, uint8_t value)
+void Cartridge::LoadState(state::Reader& reader)
 {
-    if (address >= 0x0000 && address <= 0x1fff) {
-        externalRamEnabled = (value & 0xf) != 0;
-        return;
+    mapper->LoadState(reader);
+    UpdateMapping();
+    reader.ReadRegion(externalRAM, ramSize);
+}
+
+uint8_t* Cartridge::GetWritePointer(const Address address)
+{
+    if (address >= 0xa000 && address <= 0xbfff) {
+        if (!ramAccessible || mapper->GetUnusedRAMBits() != 0) return nullptr;
+        const auto offset = ramOffset + ((address - 0xa000) & ramMask);
+        if (trackDirty && !dirtyRAMPage[offset / RAMPageSize]) return nullptr;
+        return &externalRAM[offset];
     }
+    return nullptr;
+}
 
-    if (address >= 0x2000 && address <= 0x3fff) {
-        currentRomBank= value & 0x1f;
-        if ((currentRomBank & 0xf) == 0)
-            ++currentRomBank;
-        if (enableTracing)
-            std::cout << fmt::format("cartridge: rom bank {} selected (wrote {:02x} to {:04x})\n", currentRomBank, value, address);
-        return;
+uint8_t Cartridge::Read_u8(const Address address)
+{
+    if (address <= 0x7fff) {
+        const size_t offset = romOffset[address >> 14] + (address & 0x3fff);
+        if (offset >= cartridgeData.size()) return 0xff;
+        return cartridgeData[offset];
     }
 
-    if (address >= 0x4000 && address <= 0x5fff) {
-        std::cout << fmt::format("cartridge: TODO: set ram/rom bank {:02x}\n", value);
-        return;
+    if (address >= 0xa000 && address <= 0xbfff) {
+        const auto& mapping = mapper->GetMapping();
+        if (mapping.ramEnabled && mapping.registerSelected)
+            return mapper->ReadRegister();
+        if (!ramAccessible) {
+            if (enableTracing)
+                std::cout << fmt::format("cartridge: ignoring read from address {:04x}, extram disabled\n", address);
+            return 0xff;
+        }
+        return externalRAM[ramOffset + ((address - 0xa000) & ramMask)] | mapper->GetUnusedRAMBits();
     }
 
-    if (address >= 0x6000 && address <= 0x7fff) {
-        std::cout << fmt::format("cartridge: TODO: set rom/ram mode {:02x}\n", value);
-        return;
+    std::cout << fmt::format("cartridge: ignoring read from address {:04x}, unmapped\n", address);
+    return 0xff;
+}
+
+bool Cartridge::Write_u8(const Address address, uint8_t value)
+{
+    if (address <= 0x7fff) {
+        const bool wasAccessible = ramAccessible;
+        mapper->Write(address, value);
+        const bool changed = UpdateMapping();
+        // Games disable the RAM once they are done writing to it
+        if (wasAccessible && !ramAccessible)
+            FlushSaveFile();
+        if (changed && enableTracing) {
+            const auto& mapping = mapper->GetMapping();
+            std::cout << fmt::format("cartridge: rom banks {}/{}, ram bank {} {} (wrote {:02x} to {:04x})\n",
+                mapping.rom0, mapping.rom1, mapping.ram, ramAccessible ? "enabled" : "disabled", value, address);
+        }
+        return changed;
     }
 
     if (address >= 0xa000 && address <= 0xbfff) {
-        if (!externalRamEnabled) {
+        const auto& mapping = mapper->GetMapping();
+        if (mapping.ramEnabled && mapping.registerSelected) {
+            mapper->WriteRegister(value);
+            return false;
+        }
+        if (!ramAccessible) {
             std::cout << fmt::format("cartridge: ignoring write to address {:04x}, extram disabled\n", address);
-            return;
+            return false;
+        }
+        const auto offset = ramOffset + ((address - 0xa000) & ramMask);
+        externalRAM[offset] = value | mapper->GetUnusedRAMBits();
+        if (const auto page = offset / RAMPageSize; !dirtyRAMPage[page]) {
+            dirtyRAMPage[page] = true;
+            return trackDirty;
         }
-        externalRAM[address - 0xa000] = value;
-        return;
+        return false;
     }
 
     std::cout << fmt::format("cartridge: ignoring write to address {:04x}, unmapped\n", address);
+    return false;
 }
 
 }
@@ -1,13 +1,87 @@
 #pragma once
 
+#include "mapper.h"
+#include "rom.h"
+#include "save_file.h"
+#include "scheduler.h"
 #include "types.h"
+#include <array>
+#include <memory>
 #include <string>
+#include <vector>
 
-namespace gb::cartridge {
+namespace gb {
 
-void Load(const std::string& path);
-uint8_t Read_u8(const Address address);
-void Write_u8(const Address address, uint8_t value);
-void SetTracing(const bool enabled);
+namespace state { class Reader; class Writer; }
+
+class Cartridge
+{
+public:
+    // Throws std::runtime_error if the cartridge type is not supported
+    Cartridge(const Scheduler& scheduler, std::shared_ptr<const ROM> rom);
+
+    uint8_t Read_u8(const Address address);
+    // Returns whether the host pointers changed, i.e. after a bank switch
+    // or the first write to a clean RAM page
+    bool Write_u8(const Address address, uint8_t value);
+    void SetTracing(const bool enabled);
+
+    // Host pointers for directly accessible cartridge memory at the given
+    // address, or nullptr if the access has to go through Read_u8/Write_u8
+    const uint8_t* GetReadPointer(const Address address);
+    uint8_t* GetWritePointer(const Address address);
+
+    const ROM& GetROM() const { return cartridgeData; }
+    bool HasBattery() const { return type.battery; }
+    // The ROM bank currently visible at address (which is below 0x8000)
+    size_t GetROMBank(const Address address) const { return romOffset[address >> 14] / Mapper::ROMBankSize; }
+
+    // Keeps the external RAM in the file at path from now on, replacing
+    // its contents with those of the file; as the host pointers change,
+    // the memory page table has to be rebuilt. Throws std::runtime_error
+    // if the file cannot be used
+    void AttachSaveFile(const std::string& path);
+    // Writes the RAM back to the save file, if any, without waiting. This
+    // happens by itself whenever the game disables the RAM
+    void FlushSaveFile();
+    // The banking state and external RAM; the ROM itself is not stored
+    void SaveState(state::Writer& writer) const;
+    void LoadState(state::Reader& reader);
+
+    // External RAM, in pages of RAMPageSize bytes. With dirty tracking,
+    // GetWritePointer() refuses clean pages, so the first write to every
+    // page after ClearDirtyPages() goes through Write_u8 and is noticed
+    static constexpr size_t RAMPageSize = 256;
+    size_t GetNumberOfRAMPages() const { return ramSize / RAMPageSize; }
+    uint8_t* GetRAMPage(const size_t page) { return &externalRAM[page * RAMPageSize]; }
+    bool IsRAMPageDirty(const size_t page) const { return dirtyRAMPage[page]; }
+    void SetDirtyTracking(const bool enabled) { trackDirty = enabled; }
+    void ClearDirtyPages() { dirtyRAMPage.assign(dirtyRAMPage.size(), false); }
+
+private:
+    // Recomputes the offsets of the visible banks from the mapper; returns
+    // whether they changed
+    bool UpdateMapping();
+
+    std::shared_ptr<const ROM> rom;
+    const ROM& cartridgeData;
+    mapper::CartridgeType type;
+    std::unique_ptr<Mapper> mapper;
+    // Either in ownRAM or in saveFile
+    uint8_t* externalRAM{};
+    size_t ramSize{};
+    std::vector<uint8_t> ownRAM;
+    std::unique_ptr<SaveFile> saveFile;
+    std::vector<bool> dirtyRAMPage;
+    size_t numberOfROMBanks{};
+    // Offsets of the visible banks in the ROM and externalRAM
+    std::array<size_t, 2> romOffset{};
+    size_t ramOffset{};
+    size_t ramMask{};
+    // The RAM is enabled and is plain memory
+    bool ramAccessible{};
+    bool trackDirty = false;
+    bool enableTracing = false;
+};
 
 }
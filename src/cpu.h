@@ -9,6 +9,7 @@
 #include <array>
 #include <cstdint>
 #include "memory.h"
+#include "registers.h"
 #include "types.h"
 
 #include <iostream>
@@ -17,54 +18,6 @@ namespace gb::cpu {
     using Memory = gb::Memory;
     using Cycles = int;
 
-    enum class Flag : uint8_t {
-        z = (1 << 7), // Zero
-        n = (1 << 6), // Add/Sub (BCD)
-        h = (1 << 5), // Half carry(BCD)
-        c = (1 << 4) // Carry
-    };
-
-    struct Registers {
-        uint8_t a{}, b{}, c{}, d{}, e{}, h{}, l{};
-        uint8_t fl{};
-        bool ime{};
-        bool halt{};
-        bool stop{};
-        Address pc{}, sp{};
-    };
-
-    namespace flag {
-        inline constexpr uint8_t mask = 0xf0;
-
-        constexpr void Set(Registers& regs, const Flag flag)
-        {
-            regs.fl |= static_cast<uint8_t>(flag);
-        }
-
-        constexpr void Clear(Registers& regs, const Flag flag)
-        {
-            regs.fl &= ~static_cast<uint8_t>(flag);
-        }
-
-        constexpr void Assign(Registers& regs, const Flag flag, const bool set)
-        {
-            if (set)
-                Set(regs, flag);
-            else
-                Clear(regs, flag);
-        }
-
-        constexpr bool IsSet(const Registers& regs, const Flag flag)
-        {
-            return (regs.fl & static_cast<uint8_t>(flag)) != 0;
-        }
-
-        constexpr bool IsClear(const Registers& regs, const Flag flag)
-        {
-            return !IsSet(regs, flag);
-        }
-    }
-
     namespace detail {
         constexpr uint16_t FuseRegisters(const uint8_t a, const uint8_t b)
         {
@@ -77,14 +30,14 @@ namespace gb::cpu {
             b = v & 0xff;
         }
 
-        uint8_t ReadAndAdvancePC_u8(Registers& regs, Memory& mem)
+        inline uint8_t ReadAndAdvancePC_u8(Registers& regs, Memory& mem)
         {
             const auto result = mem.Read_u8(regs.pc);
             ++regs.pc;
             return result;
         }
 
-        uint16_t ReadAndAdvancePC_u16(Registers& regs, Memory& mem)
+        inline uint16_t ReadAndAdvancePC_u16(Registers& regs, Memory& mem)
         {
             const auto lo = ReadAndAdvancePC_u8(regs, mem);
             const auto hi = ReadAndAdvancePC_u8(regs, mem);
@@ -168,29 +121,29 @@ namespace gb::cpu {
             flag::Assign(regs, Flag::h, halfCarry);
         }
 
-        void Inc_r8(Registers& regs, uint8_t& r)
+        inline void Inc_r8(Registers& regs, uint8_t& r)
         {
             Add_u8(regs, r, 1);
         }
 
-        void Dec_r8(Registers& regs, uint8_t& r)
+        inline void Dec_r8(Registers& regs, uint8_t& r)
         {
             Sub_u8(regs, r, 1);
         }
 
-        void Inc_r16(uint8_t& x, uint8_t& y) {
+        inline void Inc_r16(uint8_t& x, uint8_t& y) {
             auto xy = detail::FuseRegisters(x, y);
             ++xy;
             detail::DivideRegisters(xy, x, y);
         }
 
-        void Dec_r16(uint8_t& x, uint8_t& y) {
+        inline void Dec_r16(uint8_t& x, uint8_t& y) {
             auto xy = detail::FuseRegisters(x, y);
             --xy;
             detail::DivideRegisters(xy, x, y);
         }
 
-        void Add_HL_r16(Registers& regs, const uint8_t x, const uint8_t y)
+        inline void Add_HL_r16(Registers& regs, const uint8_t x, const uint8_t y)
         {
             auto hl = detail::FuseRegisters(regs.h, regs.l);
             const auto xy = detail::FuseRegisters(x, y);
@@ -198,35 +151,37 @@ namespace gb::cpu {
             detail::DivideRegisters(hl, regs.h, regs.l);
         }
 
-        void Push_u8(Registers& regs, Memory& mem, const uint8_t v)
+        inline void Push_u8(Registers& regs, Memory& mem, const uint8_t v)
         {
             --regs.sp;
             mem.Write_u8(regs.sp, v);
         }
 
-        void Push_u16(Registers& regs, Memory& mem, const uint16_t v)
+        inline void Push_u16(Registers& regs, Memory& mem, const uint16_t v)
         {
             Push_u8(regs, mem, v >> 8);
             Push_u8(regs, mem, v & 0xff);
         }
 
-        uint8_t Pop_u8(Registers& regs, Memory& mem)
+        inline uint8_t Pop_u8(Registers& regs, Memory& mem)
         {
             const uint16_t v = mem.Read_u8(regs.sp);
             ++regs.sp;
             return v;
         }
 
-        uint16_t Pop_u16(Registers& regs, Memory& mem)
+        inline uint16_t Pop_u16(Registers& regs, Memory& mem)
         {
             const uint16_t lo = Pop_u8(regs, mem);
             const uint16_t hi = Pop_u8(regs, mem);
             return (hi << 8) | lo;
         }
 
-        Cycles HandleRelativeJump(Registers& regs, Memory& mem, const bool take)
+        // The jump and call handlers are split, so the block cache can
+        // pass an immediate it has read in advance; regs.pc must point
+        // past the instruction
+        inline Cycles RelativeJump(Registers& regs, const int8_t v, const bool take)
         {
-            const int8_t v = detail::ReadAndAdvancePC_u8(regs, mem);
             if (take) {
                 regs.pc += v;
                 return 12;
@@ -234,7 +189,13 @@ namespace gb::cpu {
             return 8;
         }
 
-        Cycles HandleRelativeReturn(Registers& regs, Memory& mem, const bool take)
+        inline Cycles HandleRelativeJump(Registers& regs, Memory& mem, const bool take)
+        {
+            const int8_t v = detail::ReadAndAdvancePC_u8(regs, mem);
+            return RelativeJump(regs, v, take);
+        }
+
+        inline Cycles HandleRelativeReturn(Registers& regs, Memory& mem, const bool take)
         {
             if (take) {
                 regs.pc = Pop_u16(regs, mem);
@@ -243,9 +204,8 @@ namespace gb::cpu {
             return 8;
         }
 
-        Cycles HandleAbsoluteJump(Registers& regs, Memory& mem, const bool take)
+        inline Cycles AbsoluteJump(Registers& regs, const uint16_t v, const bool take)
         {
-            const auto v = detail::ReadAndAdvancePC_u16(regs, mem);
             if (take) {
                 regs.pc = v;
                 return 16;
@@ -253,9 +213,14 @@ namespace gb::cpu {
             return 12;
         }
 
-        Cycles HandleAbsoluteCall(Registers& regs, Memory& mem, const bool take)
+        inline Cycles HandleAbsoluteJump(Registers& regs, Memory& mem, const bool take)
         {
             const auto v = detail::ReadAndAdvancePC_u16(regs, mem);
+            return AbsoluteJump(regs, v, take);
+        }
+
+        inline Cycles AbsoluteCall(Registers& regs, Memory& mem, const uint16_t v, const bool take)
+        {
             if (take) {
                 detail::Push_u16(regs, mem, regs.pc);
                 regs.pc = v;
@@ -264,7 +229,13 @@ namespace gb::cpu {
             return 12;
         }
 
-        void DAA(Registers& regs)
+        inline Cycles HandleAbsoluteCall(Registers& regs, Memory& mem, const bool take)
+        {
+            const auto v = detail::ReadAndAdvancePC_u16(regs, mem);
+            return AbsoluteCall(regs, mem, v, take);
+        }
+
+        inline void DAA(Registers& regs)
         {
             // From https://forums.nesdev.com/viewtopic.php?t=15944
             uint8_t& a = regs.a;
@@ -321,20 +292,20 @@ namespace gb::cpu {
             return 4;
         }
 
-        Cycles Rst(Registers& regs, Memory& mem, const uint8_t op)
+        inline Cycles Rst(Registers& regs, Memory& mem, const uint8_t op)
         {
             Push_u16(regs, mem, regs.pc);
             regs.pc = op;
             return 16;
         }
 
-        Cycles InvalidInstruction(Registers& regs, Memory& mem)
+        inline Cycles InvalidInstruction(Registers& regs, Memory& mem)
         {
             std::cerr << "Invalid instruction!\n";
             return 4;
         }
 
-        Cycles Rlc(Registers& regs, uint8_t& r)
+        inline Cycles Rlc(Registers& regs, uint8_t& r)
         {
             const bool carry = (r & 0x80) != 0;
             r = (r << 1) & 0xff;
@@ -346,7 +317,7 @@ namespace gb::cpu {
             return 4;
         }
 
-        void Rrc(Registers& regs, uint8_t& r)
+        inline void Rrc(Registers& regs, uint8_t& r)
         {
             const bool carry = (r & 1) != 0;
             r = r >> 1;
@@ -366,7 +337,7 @@ namespace gb::cpu {
             mem.Write_u8(hl, v);
         }
 
-        void Rl(Registers& regs, uint8_t& r)
+        inline void Rl(Registers& regs, uint8_t& r)
         {
             const bool carry = (r & 0x80) != 0;
             r = (r << 1) & 0xff;
@@ -377,7 +348,7 @@ namespace gb::cpu {
             flag::Assign(regs, Flag::c, carry);
         }
 
-        void Rr(Registers& regs, uint8_t& r)
+        inline void Rr(Registers& regs, uint8_t& r)
         {
             const bool carry = (r & 1) != 0;
             r = r >> 1;
@@ -388,7 +359,7 @@ namespace gb::cpu {
             flag::Assign(regs, Flag::c, carry);
         }
 
-        void Sla(Registers& regs, uint8_t& r)
+        inline void Sla(Registers& regs, uint8_t& r)
         {
             const bool carry = (r & 0x80) != 0;
             r = (r << 1) & 0xff;
@@ -398,7 +369,7 @@ namespace gb::cpu {
             flag::Assign(regs, Flag::c, carry);
         }
 
-        void Sra(Registers& regs, uint8_t& r)
+        inline void Sra(Registers& regs, uint8_t& r)
         {
             const bool carry = (r & 1) != 0;
             r = (r & 0x80) | r >> 1;
@@ -408,7 +379,7 @@ namespace gb::cpu {
             flag::Assign(regs, Flag::c, carry);
         }
 
-        void Swap(Registers& regs, uint8_t& r)
+        inline void Swap(Registers& regs, uint8_t& r)
         {
             r = (r >> 4) | ((r & 0xf) << 4);
             flag::Assign(regs, Flag::z, r == 0);
@@ -417,7 +388,7 @@ namespace gb::cpu {
             flag::Clear(regs, Flag::c);
         }
 
-        void Srl(Registers& regs, uint8_t& r)
+        inline void Srl(Registers& regs, uint8_t& r)
         {
             const bool carry = (r & 1) != 0;
             r = r >> 1;
@@ -463,9 +434,10 @@ namespace gb::cpu {
         Function func;
     };
 
-    void InvokeIRQ(Registers& regs, Memory& memory, int n)
+    inline void InvokeIRQ(Registers& regs, Memory& memory, int n)
     {
         // TODO wait 20 cycles
+        regs.ime = false;
         detail::Push_u16(regs, memory, regs.pc);
         regs.pc = 0x40 + 8 * n;
     }
@@ -2614,4 +2586,10 @@ namespace gb::cpu {
                     return detail::Rst(regs, mem, 0x38);
                  } },
     } };
+
+    // Opcodes the CPU does not implement; executing one locks up the machine
+    constexpr bool IsInvalidOpcode(const uint8_t op)
+    {
+        return opcode[op].name.substr(0, 4) == "<inv";
+    }
 }
@@ -0,0 +1,258 @@
+#include "differential.h"
+#include "cpu.h"
+#include "disassembler.h"
+#include "mapper.h"
+#include "system.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "fmt/core.h"
+
+namespace gb::differential {
+
+namespace {
+    constexpr size_t ROMSize = 0x8000;
+    constexpr Address Entry = 0x100;
+    constexpr Address CartridgeTypeAddress = 0x147;
+    constexpr Address ROMSizeAddress = 0x148;
+    constexpr Address RAMSizeAddress = 0x149;
+
+    bool EndsRun(const uint8_t opcode)
+    {
+        return cpu::IsInvalidOpcode(opcode) || opcode == 0x76 /* halt */ || opcode == 0x10 /* stop */;
+    }
+
+    bool operator==(const cpu::Registers& a, const cpu::Registers& b)
+    {
+        return a.a == b.a && a.b == b.b && a.c == b.c && a.d == b.d && a.e == b.e && a.h == b.h && a.l == b.l &&
+            a.fl == b.fl && a.ime == b.ime && a.halt == b.halt && a.stop == b.stop && a.pc == b.pc && a.sp == b.sp;
+    }
+
+    std::string CompareMemory(System& reference, System& fast)
+    {
+        const auto& a = reference.memory.data;
+        const auto& b = fast.memory.data;
+        if (const auto m = std::mismatch(a.begin(), a.end(), b.begin()); m.first != a.end())
+            return fmt::format("memory differs at {:04x}: {:02x} (reference) != {:02x}", m.first - a.begin(), *m.first, *m.second);
+        const auto& ioA = reference.io.data;
+        const auto& ioB = fast.io.data;
+        if (const auto m = std::mismatch(ioA.begin(), ioA.end(), ioB.begin()); m.first != ioA.end())
+            return fmt::format("I/O register {:04x} differs: {:02x} (reference) != {:02x}", memory_map::IOStart + (m.first - ioA.begin()), *m.first, *m.second);
+        if (reference.io.ie != fast.io.ie)
+            return fmt::format("IE differs: {:02x} (reference) != {:02x}", reference.io.ie, fast.io.ie);
+        for (size_t page = 0; page < reference.cartridge.GetNumberOfRAMPages(); ++page) {
+            const auto pageA = reference.cartridge.GetRAMPage(page);
+            const auto pageB = fast.cartridge.GetRAMPage(page);
+            if (memcmp(pageA, pageB, Cartridge::RAMPageSize) != 0)
+                return fmt::format("cartridge RAM page {} differs", page);
+        }
+        return {};
+    }
+
+    // Both paths have to perform the same writes, in the same order
+    std::string CompareWrites(const trace::Buffer& reference, const trace::Buffer& fast)
+    {
+        const auto isWrite = [](const trace::Record& record) { return record.type == trace::RecordType::MemoryWrite; };
+        const auto a = reference.GetRecords(), b = fast.GetRecords();
+        auto itA = std::find_if(a.begin(), a.end(), isWrite);
+        auto itB = std::find_if(b.begin(), b.end(), isWrite);
+        for (; itA != a.end() && itB != b.end(); itA = std::find_if(itA + 1, a.end(), isWrite), itB = std::find_if(itB + 1, b.end(), isWrite)) {
+            if (itA->address != itB->address || itA->value != itB->value)
+                return fmt::format("writes differ: {:02x} to {:04x} (reference) != {:02x} to {:04x}", itA->value, itA->address, itB->value, itB->address);
+        }
+        if (itA != a.end())
+            return fmt::format("only the reference writes {:02x} to {:04x}", itA->value, itA->address);
+        if (itB != b.end())
+            return fmt::format("only the fast path writes {:02x} to {:04x}", itB->value, itB->address);
+        return {};
+    }
+
+    // The registers which matter to the known results
+    struct Values {
+        uint8_t a, fl;
+        uint16_t bc, hl, sp;
+    };
+
+    struct KnownResult {
+        uint8_t code[3];
+        Values before, after;
+        int cycles;
+    };
+
+    // Hand-computed from the documented flag behaviour
+    constexpr KnownResult knownResults[] = {
+        { { 0x80 }, { 0x3a, 0x00, 0xc600, 0, 0xdff0 }, { 0x00, 0xb0, 0xc600, 0, 0xdff0 }, 4 },       // add a,b
+        { { 0x80 }, { 0x3c, 0x00, 0x1200, 0, 0xdff0 }, { 0x4e, 0x00, 0x1200, 0, 0xdff0 }, 4 },
+        { { 0x80 }, { 0x0f, 0x00, 0x0100, 0, 0xdff0 }, { 0x10, 0x20, 0x0100, 0, 0xdff0 }, 4 },
+        { { 0x88 }, { 0xe1, 0x10, 0x0f00, 0, 0xdff0 }, { 0xf1, 0x20, 0x0f00, 0, 0xdff0 }, 4 },       // adc a,b
+        { { 0x88 }, { 0xe1, 0x10, 0x1e00, 0, 0xdff0 }, { 0x00, 0xb0, 0x1e00, 0, 0xdff0 }, 4 },
+        { { 0x90 }, { 0x3e, 0x00, 0x3e00, 0, 0xdff0 }, { 0x00, 0xc0, 0x3e00, 0, 0xdff0 }, 4 },       // sub b
+        { { 0x90 }, { 0x3e, 0x00, 0x0f00, 0, 0xdff0 }, { 0x2f, 0x60, 0x0f00, 0, 0xdff0 }, 4 },
+        { { 0x90 }, { 0x3e, 0x00, 0x4000, 0, 0xdff0 }, { 0xfe, 0x50, 0x4000, 0, 0xdff0 }, 4 },
+        { { 0x98 }, { 0x3b, 0x10, 0x2a00, 0, 0xdff0 }, { 0x10, 0x40, 0x2a00, 0, 0xdff0 }, 4 },       // sbc a,b
+        { { 0x98 }, { 0x3b, 0x10, 0x4f00, 0, 0xdff0 }, { 0xeb, 0x70, 0x4f00, 0, 0xdff0 }, 4 },
+        { { 0xfe, 0x3c }, { 0x3c, 0x00, 0, 0, 0xdff0 }, { 0x3c, 0xc0, 0, 0, 0xdff0 }, 8 },           // cp 3ch
+        { { 0xe6, 0x38 }, { 0x5a, 0x00, 0, 0, 0xdff0 }, { 0x18, 0x20, 0, 0, 0xdff0 }, 8 },           // and 38h
+        { { 0xaf }, { 0xff, 0x70, 0, 0, 0xdff0 }, { 0x00, 0x80, 0, 0, 0xdff0 }, 4 },                 // xor a
+        { { 0x04 }, { 0x00, 0x10, 0x0f00, 0, 0xdff0 }, { 0x00, 0x30, 0x1000, 0, 0xdff0 }, 4 },       // inc b
+        { { 0x05 }, { 0x00, 0x00, 0x0100, 0, 0xdff0 }, { 0x00, 0xc0, 0x0000, 0, 0xdff0 }, 4 },       // dec b
+        { { 0x05 }, { 0x00, 0x00, 0x1000, 0, 0xdff0 }, { 0x00, 0x60, 0x0f00, 0, 0xdff0 }, 4 },
+        { { 0x03 }, { 0x00, 0x50, 0xffff, 0, 0xdff0 }, { 0x00, 0x50, 0x0000, 0, 0xdff0 }, 8 },       // inc bc
+        { { 0x09 }, { 0x00, 0x80, 0x0605, 0x8a23, 0xdff0 }, { 0x00, 0xa0, 0x0605, 0x9028, 0xdff0 }, 8 }, // add hl,bc
+        { { 0x29 }, { 0x00, 0x00, 0, 0x8a23, 0xdff0 }, { 0x00, 0x30, 0, 0x1446, 0xdff0 }, 8 },       // add hl,hl
+        { { 0xe8, 0x02 }, { 0x00, 0xc0, 0, 0, 0xfff8 }, { 0x00, 0x00, 0, 0, 0xfffa }, 16 },        // add sp,2
+        { { 0xe8, 0x08 }, { 0x00, 0x00, 0, 0, 0xfff8 }, { 0x00, 0x30, 0, 0, 0x0000 }, 16 },        // add sp,8
+        { { 0xe8, 0xff }, { 0x00, 0x00, 0, 0, 0x0001 }, { 0x00, 0x30, 0, 0, 0x0000 }, 16 },        // add sp,-1
+        { { 0xe8, 0xff }, { 0x00, 0x00, 0, 0, 0x0000 }, { 0x00, 0x00, 0, 0, 0xffff }, 16 },
+        { { 0xf8, 0xff }, { 0x00, 0x00, 0, 0, 0x0100 }, { 0x00, 0x00, 0, 0x00ff, 0x0100 }, 12 },   // ld hl,sp-1
+        { { 0xf8, 0x01 }, { 0x00, 0x00, 0, 0, 0x00ff }, { 0x00, 0x30, 0, 0x0100, 0x00ff }, 12 },   // ld hl,sp+1
+        { { 0x27 }, { 0x7d, 0x00, 0, 0, 0xdff0 }, { 0x83, 0x00, 0, 0, 0xdff0 }, 4 },                 // daa
+        { { 0x27 }, { 0x9a, 0x00, 0, 0, 0xdff0 }, { 0x00, 0x90, 0, 0, 0xdff0 }, 4 },
+        { { 0x27 }, { 0x0f, 0x60, 0, 0, 0xdff0 }, { 0x09, 0x40, 0, 0, 0xdff0 }, 4 },
+        { { 0x07 }, { 0x85, 0x00, 0, 0, 0xdff0 }, { 0x0b, 0x10, 0, 0, 0xdff0 }, 4 },                 // rlca
+        { { 0x2f }, { 0x35, 0x00, 0, 0, 0xdff0 }, { 0xca, 0x60, 0, 0, 0xdff0 }, 4 },                 // cpl
+        { { 0x37 }, { 0x00, 0x80, 0, 0, 0xdff0 }, { 0x00, 0x90, 0, 0, 0xdff0 }, 4 },                 // scf
+        { { 0x3f }, { 0x00, 0x90, 0, 0, 0xdff0 }, { 0x00, 0x80, 0, 0, 0xdff0 }, 4 },                 // ccf
+        { { 0xcb, 0x37 }, { 0x00, 0x70, 0, 0, 0xdff0 }, { 0x00, 0x80, 0, 0, 0xdff0 }, 8 },           // swap a
+        { { 0xcb, 0x7c }, { 0x00, 0x10, 0, 0x7f00, 0xdff0 }, { 0x00, 0xb0, 0, 0x7f00, 0xdff0 }, 8 }, // bit 7,h
+    };
+
+    // Where the code of the known results runs from
+    constexpr Address KnownResultBase = 0xc000;
+
+    cpu::Registers ToRegisters(const Values& values, const Address pc)
+    {
+        cpu::Registers regs;
+        regs.a = values.a;
+        regs.fl = values.fl;
+        regs.b = values.bc >> 8; regs.c = values.bc & 0xff;
+        regs.h = values.hl >> 8; regs.l = values.hl & 0xff;
+        regs.sp = values.sp;
+        regs.pc = pc;
+        return regs;
+    }
+}
+
+Outcome Run(std::shared_ptr<const ROM> rom, const Options& options, const cpu::Registers* start)
+{
+    System reference(rom), fast(rom);
+    trace::Buffer referenceWrites(256), fastWrites(256);
+    for (auto* system: { &reference, &fast }) {
+        system->Reset(false);
+        if (start)
+            system->regs = *start;
+    }
+    if (options.compareWrites) {
+        reference.SetTrace(&referenceWrites, true);
+        fast.SetTrace(&fastWrites, true);
+    }
+
+    Outcome outcome;
+    for (; outcome.instructions < options.maxInstructions; ++outcome.instructions) {
+        const auto before = reference.regs;
+        const uint8_t bytes[3] = { reference.memory.At_u8(before.pc), reference.memory.At_u8(before.pc + 1), reference.memory.At_u8(before.pc + 2) };
+        if (EndsRun(bytes[0]) || before.halt || before.stop)
+            break;
+
+        referenceWrites.Clear();
+        fastWrites.Clear();
+        reference.Step();
+        fast.Run(1);
+
+        const bool checkMemory = options.memoryInterval != 0 && (outcome.instructions + 1) % options.memoryInterval == 0;
+        std::string difference;
+        if (!(reference.regs == fast.regs))
+            difference = fmt::format("registers differ: {} (reference) != {}", disassembler::RegistersToString(reference.regs), disassembler::RegistersToString(fast.regs));
+        else if (reference.scheduler.now != fast.scheduler.now)
+            difference = fmt::format("clock differs: {} (reference) != {}", reference.scheduler.now, fast.scheduler.now);
+        else if (options.compareWrites)
+            difference = CompareWrites(referenceWrites, fastWrites);
+        if (difference.empty() && checkMemory)
+            difference = CompareMemory(reference, fast);
+        if (!difference.empty()) {
+            outcome.mismatch = fmt::format("after instruction {} ({}), from {}: {}", outcome.instructions, disassembler::Disassemble(before.pc, bytes), disassembler::RegistersToString(before), difference);
+            return outcome;
+        }
+    }
+    outcome.mismatch = CompareMemory(reference, fast);
+    if (!outcome.mismatch.empty())
+        outcome.mismatch = fmt::format("after {} instructions: {}", outcome.instructions, outcome.mismatch);
+    return outcome;
+}
+
+std::vector<std::string> CheckKnownResults()
+{
+    const auto rom = std::make_shared<ROM>(std::vector<uint8_t>(ROMSize));
+    System reference(rom), fast(rom);
+    const std::pair<System*, const char*> paths[] = { { &reference, "reference" }, { &fast, "fast path" } };
+    std::vector<std::string> failures;
+    for (const auto& [system, name]: paths) {
+        system->Reset(false);
+        // Nothing may interrupt the instructions
+        system->io.ie = 0;
+        for (const auto& known: knownResults) {
+            // Writing the code invalidates the blocks decoded for the last one
+            for (size_t n = 0; n < sizeof(known.code); ++n)
+                system->memory.Write_u8(KnownResultBase + n, known.code[n]);
+            system->regs = ToRegisters(known.before, KnownResultBase);
+            const auto start = system->scheduler.now;
+            if (system == &reference)
+                system->Step();
+            else
+                system->Run(1);
+
+            const auto length = disassembler::GetInstructionLength(known.code[0]);
+            const auto expected = ToRegisters(known.after, KnownResultBase + length);
+            const int cycles = static_cast<int>(system->scheduler.now - start);
+            if (!(system->regs == expected) || cycles != known.cycles) {
+                failures.push_back(fmt::format("{}: {} from {}: {}, {} cycles (expected {}, {} cycles)", name,
+                    disassembler::Disassemble(KnownResultBase, known.code), disassembler::RegistersToString(ToRegisters(known.before, KnownResultBase)),
+                    disassembler::RegistersToString(system->regs), cycles, disassembler::RegistersToString(expected), known.cycles));
+            }
+        }
+    }
+    return failures;
+}
+
+cpu::Registers GetRandomRegisters(std::mt19937_64& random)
+{
+    const auto value = random();
+    cpu::Registers regs;
+    regs.a = value; regs.fl = (value >> 8) & cpu::flag::mask;
+    regs.b = value >> 16; regs.c = value >> 24;
+    regs.d = value >> 32; regs.e = value >> 40;
+    regs.h = value >> 48; regs.l = value >> 56;
+    regs.sp = random();
+    regs.ime = (random() & 1) != 0;
+    regs.pc = Entry;
+    return regs;
+}
+
+std::shared_ptr<const ROM> GenerateROM(std::mt19937_64& random)
+{
+    std::vector<uint8_t> contents(ROMSize);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (auto& value: contents) {
+        do {
+            value = byte(random);
+        } while (EndsRun(value));
+    }
+    contents[CartridgeTypeAddress] = 0;
+    contents[ROMSizeAddress] = 0;
+    contents[RAMSizeAddress] = 0;
+    return std::make_shared<ROM>(std::move(contents));
+}
+
+std::vector<uint8_t> MakeCartridge(const uint8_t* data, const size_t size)
+{
+    std::vector<uint8_t> contents(data, data + size);
+    if (contents.size() < ROMSize)
+        contents.resize(ROMSize);
+    if (!mapper::GetCartridgeType(contents[CartridgeTypeAddress]))
+        contents[CartridgeTypeAddress] = 0;
+    return contents;
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "registers.h"
+#include "rom.h"
+
+namespace gb::differential {
+
+// Runs a ROM on two machines in lock-step, one instruction at a time: the
+// reference goes through System::Step(), which calls the opcode[] handlers
+// through their function pointers, the other through System::Run(), the
+// fast path with the pre-decoded blocks and the inlined dispatch. After
+// every instruction the registers, the clock and the memory writes are
+// compared, and every memoryInterval instructions (and at the end) all
+// memory and I/O as well. As both paths share the instruction semantics,
+// this only finds bugs of the fast path; CheckKnownResults() covers the
+// semantics themselves
+struct Options {
+    size_t maxInstructions{1'000'000};
+    size_t memoryInterval{1024};
+    // Recording the writes takes every access off the page table, so
+    // without, the page table fast path gets exercised instead
+    bool compareWrites{true};
+};
+
+struct Outcome {
+    size_t instructions{};
+    // Describes the first difference; empty if the machines agreed until
+    // the end. Runs end early when the CPU reaches an invalid opcode or
+    // halts, as the fast path skips idle time differently
+    std::string mismatch;
+};
+
+// Both machines start from the state after the bootstrap ROM, with the
+// registers replaced by start if given, so random runs do not all begin
+// alike. Throws std::runtime_error if the cartridge is not supported
+Outcome Run(std::shared_ptr<const ROM> rom, const Options& options, const cpu::Registers* start = nullptr);
+
+// Runs a table of instructions with hand-computed results, mostly ALU
+// flags, through both paths. Returns a description of every failure
+std::vector<std::string> CheckKnownResults();
+
+// Random contents for all registers; execution still starts at 0x100
+cpu::Registers GetRandomRegisters(std::mt19937_64& random);
+
+// A 32 KiB cartridge without a mapper full of random code, free of the
+// opcodes that would end a run. Jumps still take execution anywhere,
+// including RAM and I/O
+std::shared_ptr<const ROM> GenerateROM(std::mt19937_64& random);
+
+// Makes arbitrary bytes (e.g. from a fuzzer) usable as a cartridge: pads
+// them to a full bank and replaces an unsupported cartridge type by one
+// without a mapper
+std::vector<uint8_t> MakeCartridge(const uint8_t* data, const size_t size);
+
+}
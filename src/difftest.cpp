@@ -0,0 +1,133 @@
+#include "differential.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <unistd.h>
+
+#include "fmt/core.h"
+
+namespace {
+
+long optionCases = 1000;
+uint64_t optionSeed = 1;
+unsigned int optionThreads = 0;
+gb::differential::Options options;
+std::vector<std::string> romPaths;
+
+bool ProcessOptions(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "h?c:n:m:ws:j:")) != -1) {
+        switch(opt) {
+            case 'h':
+            case '?':
+                std::cout << fmt::format("usage: {} [-h?] [-c cases] [-n instructions] [-m interval] [-w] [-s seed] [-j threads] [cartridge.gb ...]\n\n", argv[0]);
+                std::cout << fmt::format("  -h, -?          this help\n");
+                std::cout << fmt::format("  -c cases        number of random cartridges to run (default: {})\n", optionCases);
+                std::cout << fmt::format("  -n instructions maximum number of instructions per run (default: {})\n", options.maxInstructions);
+                std::cout << fmt::format("  -m interval     compare all memory every interval instructions (default: {})\n", options.memoryInterval);
+                std::cout << fmt::format("  -w              do not compare the writes of every instruction, so the\n");
+                std::cout << fmt::format("                  fast path accesses memory through the page table\n");
+                std::cout << fmt::format("  -s seed         seed of the first random cartridge (default: {})\n", optionSeed);
+                std::cout << fmt::format("  -j threads      number of runs in parallel (default: all cores)\n\n");
+                std::cout << fmt::format("Runs random code, or the given cartridges instead, through both the\n");
+                std::cout << fmt::format("reference and the fast CPU path in lock-step and reports where they differ.\n");
+                std::cout << fmt::format("Random case n uses seed + n, so a failing case can be run on its own.\n");
+                std::cout << fmt::format("A table of instructions with known results is checked first.\n");
+                return false;
+            case 'c':
+                optionCases = std::stol(optarg);
+                break;
+            case 'n':
+                options.maxInstructions = std::stoull(optarg);
+                break;
+            case 'm':
+                options.memoryInterval = std::stoull(optarg);
+                break;
+            case 'w':
+                options.compareWrites = false;
+                break;
+            case 's':
+                optionSeed = std::stoull(optarg);
+                break;
+            case 'j':
+                optionThreads = std::stoul(optarg);
+                break;
+        }
+    }
+
+    for(int n = optind; n < argc; ++n)
+        romPaths.push_back(argv[n]);
+    return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    if (!ProcessOptions(argc, argv)) return 1;
+
+    std::vector<std::shared_ptr<const gb::ROM>> roms;
+    for (const auto& path: romPaths) {
+        try {
+            roms.push_back(gb::LoadROM(path));
+        } catch (std::exception& e) {
+            std::cout << fmt::format("cannot load '{}': {}\n", path, e.what());
+            return 1;
+        }
+    }
+
+    // Both paths agreeing is worthless if their shared semantics are wrong
+    const auto failures = gb::differential::CheckKnownResults();
+    for (const auto& failure: failures)
+        std::cout << fmt::format("known result: {}\n", failure);
+
+    std::mutex outputMutex;
+    std::atomic<uint64_t> instructions{};
+    std::atomic<long> mismatches{static_cast<long>(failures.size())};
+    const auto report = [&](const std::string& name, const gb::differential::Outcome& outcome) {
+        instructions += outcome.instructions;
+        if (outcome.mismatch.empty()) return;
+        ++mismatches;
+        std::lock_guard lock(outputMutex);
+        std::cout << fmt::format("{}: {}\n", name, outcome.mismatch);
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    {
+        gb::ThreadPool pool(optionThreads);
+        if (roms.empty()) {
+            for (long n = 0; n < optionCases; ++n) {
+                pool.Submit([&, n]() {
+                    const auto seed = optionSeed + n;
+                    std::mt19937_64 random(seed);
+                    const auto rom = gb::differential::GenerateROM(random);
+                    const auto regs = gb::differential::GetRandomRegisters(random);
+                    report(fmt::format("seed {}", seed), gb::differential::Run(rom, options, &regs));
+                });
+            }
+        } else {
+            for (size_t n = 0; n < roms.size(); ++n) {
+                pool.Submit([&, n]() {
+                    try {
+                        report(romPaths[n], gb::differential::Run(roms[n], options));
+                    } catch (std::exception& e) {
+                        std::lock_guard lock(outputMutex);
+                        std::cout << fmt::format("{}: {}\n", romPaths[n], e.what());
+                        ++mismatches;
+                    }
+                });
+            }
+        }
+        pool.Wait();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    const auto cases = roms.empty() ? optionCases : static_cast<long>(roms.size());
+    std::cerr << fmt::format("{} runs, {} instructions in {:.2f} s ({:.1f} M instructions/s), {} differ\n",
+        cases, instructions.load(), elapsed.count(), instructions / elapsed.count() / 1e6, mismatches.load());
+    return mismatches == 0 ? 0 : 1;
+}
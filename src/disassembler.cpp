@@ -0,0 +1,154 @@
+#include "disassembler.h"
+#include "cpu.h"
+#include "memory.h"
+
+#include <array>
+#include "fmt/core.h"
+
+namespace gb::disassembler {
+
+namespace {
+    int GetArgumentLength(const cpu::Argument arg)
+    {
+        switch(arg) {
+            case cpu::Argument::None: return 0;
+            case cpu::Argument::Imm8: return 1;
+            case cpu::Argument::Imm16: return 2;
+            case cpu::Argument::Rel8: return 1;
+        }
+        return 0;
+    }
+}
+
+std::string RegistersToString(const cpu::Registers& regs)
+{
+    return fmt::format("{:04x} [a {:02x} b/c {:02x}{:02x} d/e {:02x}{:02x} h/l {:02x}{:02x} flags {}{}{}{}{}{} sp {:04x}]",
+        regs.pc,
+        regs.a, regs.b, regs.c, regs.d, regs.e, regs.h, regs.l,
+        cpu::flag::IsSet(regs, cpu::Flag::z) ? 'Z' : '-',
+        cpu::flag::IsSet(regs, cpu::Flag::n) ? 'N' : '-',
+        cpu::flag::IsSet(regs, cpu::Flag::h) ? 'H' : '-',
+        cpu::flag::IsSet(regs, cpu::Flag::c) ? 'C' : '-',
+        regs.ime ? 'I' : '-',
+        regs.halt ? 'h' : '-',
+        regs.sp);
+}
+
+std::string Disassemble(const cpu::Registers& regs, const Memory& memory, const cpu::Instruction& instruction, const bool has_prefix)
+{
+    // regs.pc points past the opcode(s)
+    const Address pc = regs.pc - (has_prefix ? 2 : 1);
+    std::array<uint8_t, 3> bytes{};
+    for(size_t n = 0; n < bytes.size(); ++n)
+        bytes[n] = memory.At_u8(pc + n);
+    return Disassemble(pc, bytes.data());
+}
+
+    std::string IORegisterToString(const Address address)
+{
+        switch(address) {
+            case io::P1: return "P1";
+            case io::SB: return "SB";
+            case io::SC: return "SC";
+            case io::DIV: return "DIV";
+            case io::TIMA: return "TIMA";
+            case io::TMA: return "TMA";
+            case io::TAC: return "TAC";
+            case io::IF: return "IF";
+            case io::NR10: return "NR10";
+            case io::NR11: return "NR11";
+            case io::NR12: return "NR12";
+            case io::NR13: return "NR13";
+            case io::NR14: return "NR14";
+            case io::NR21: return "NR21";
+            case io::NR22: return "NR22";
+            case io::NR23: return "NR23";
+            case io::NR24: return "NR24";
+            case io::NR30: return "NR30";
+            case io::NR31: return "NR31";
+            case io::NR32: return "NR32";
+            case io::NR33: return "NR33";
+            case io::NR34: return "NR34";
+            case io::NR41: return "NR41";
+            case io::NR42: return "NR42";
+            case io::NR43: return "NR43";
+            case io::NR44: return "NR44";
+            case io::NR50: return "NR50";
+            case io::NR51: return "NR51";
+            case io::NR52: return "NR52";
+            case io::AUD3WAVERAM+0: return "AUD3WAVERAM+0";
+            case io::AUD3WAVERAM+1: return "AUD3WAVERAM+1";
+            case io::AUD3WAVERAM+2: return "AUD3WAVERAM+2";
+            case io::AUD3WAVERAM+3: return "AUD3WAVERAM+3";
+            case io::AUD3WAVERAM+4: return "AUD3WAVERAM+4";
+            case io::AUD3WAVERAM+5: return "AUD3WAVERAM+5";
+            case io::AUD3WAVERAM+6: return "AUD3WAVERAM+6";
+            case io::AUD3WAVERAM+7: return "AUD3WAVERAM+7";
+            case io::AUD3WAVERAM+8: return "AUD3WAVERAM+8";
+            case io::AUD3WAVERAM+9: return "AUD3WAVERAM+9";
+            case io::AUD3WAVERAM+10: return "AUD3WAVERAM+a";
+            case io::AUD3WAVERAM+11: return "AUD3WAVERAM+b";
+            case io::AUD3WAVERAM+12: return "AUD3WAVERAM+c";
+            case io::AUD3WAVERAM+13: return "AUD3WAVERAM+d";
+            case io::AUD3WAVERAM+14: return "AUD3WAVERAM+e";
+            case io::AUD3WAVERAM+15: return "AUD3WAVERAM+f";
+            case io::LCDC: return "LCDC";
+            case io::STAT: return "STAT";
+            case io::SCY: return "SCY";
+            case io::SCX: return "SCX";
+            case io::LY: return "LY";
+            case io::LYC: return "LYC";
+            case io::DMA: return "DMA";
+            case io::BGP: return "BGP";
+            case io::OBP0: return "OBP0";
+            case io::OBP1: return "OBP1";
+            case io::WY: return "WY";
+            case io::WX: return "WX";
+            case io::IE: return "IE";
+            case io::DMG: return "DMG";
+        }
+        return fmt::format("{:x}", address);
+    }
+
+int GetInstructionLength(const uint8_t opcode)
+{
+    if (opcode == 0xcb) return 2;
+    return 1 + GetArgumentLength(cpu::opcode[opcode].arg);
+}
+
+std::string Disassemble(const Address pc, const uint8_t* bytes)
+{
+    using Argument = cpu::Argument;
+
+    const bool has_prefix = bytes[0] == 0xcb;
+    const auto& instruction = has_prefix ? cpu::opcode_cb[bytes[1]] : cpu::opcode[bytes[0]];
+    const int num_bytes = GetInstructionLength(bytes[0]);
+    const uint8_t* args = &bytes[has_prefix ? 2 : 1];
+
+    std::string arg{"???"};
+    switch(instruction.arg) {
+        case Argument::None:
+            arg = "";
+            break;
+        case Argument::Imm8:
+            arg = fmt::format("{:02x}", args[0]);
+            break;
+        case Argument::Imm16:
+            arg = fmt::format("{:02x}{:02x}", args[1], args[0]);
+            break;
+        case Argument::Rel8: {
+            const uint16_t new_pc = pc + num_bytes + static_cast<int8_t>(args[0]);
+            arg = fmt::format("{:x}", new_pc);
+            break;
+        }
+    }
+
+    std::string hex;
+    for(int n = 0; n < num_bytes; ++n) {
+        hex += fmt::format("{:02x}", bytes[n]);
+    }
+
+    return fmt::format("{:8s} {}", hex, fmt::format(instruction.name, arg));
+}
+
+}
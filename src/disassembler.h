@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "types.h"
+
+namespace gb {
+    struct Memory;
+    namespace cpu {
+        struct Instruction;
+        struct Registers;
+    }
+}
+
+namespace gb::disassembler {
+
+std::string RegistersToString(const cpu::Registers& regs);
+std::string Disassemble(const cpu::Registers& regs, const Memory& memory, const cpu::Instruction& instruction, const bool has_prefix);
+
+// Name of the I/O register at address, or the address in hex
+std::string IORegisterToString(const Address address);
+
+// Number of bytes making up the instruction starting with the given opcode
+// (1 to 3); for 0xcb, this includes the second opcode byte
+int GetInstructionLength(const uint8_t opcode);
+
+// Disassembles the instruction located at pc, of which all bytes are
+// present; used where there is no memory to read from, i.e. for traces
+std::string Disassemble(const Address pc, const uint8_t* bytes);
+
+}
@@ -0,0 +1,141 @@
+#include "execution_profile.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "disassembler.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "fmt/core.h"
+
+namespace gb {
+
+namespace {
+    std::string ToString(const ExecutionProfile::Location& location)
+    {
+        if (location.bank == ExecutionProfile::NoBank)
+            return fmt::format("{:04x}", location.pc);
+        return fmt::format("{:02x}:{:04x}", location.bank, location.pc);
+    }
+
+    bool IsLess(const ExecutionProfile::Counter& a, const ExecutionProfile::Counter& b, const ExecutionProfile::SortBy sortBy)
+    {
+        if (sortBy == ExecutionProfile::SortBy::Count)
+            return a.count < b.count;
+        return a.cycles < b.cycles;
+    }
+}
+
+ExecutionProfile::ExecutionProfile(const Memory& memory)
+    : memory(memory), chunks(RAMChunks + (memory.cartridge.GetROM().size() + BankSize - 1) / BankSize)
+{
+}
+
+ExecutionProfile::Location ExecutionProfile::GetLocation(const Address pc) const
+{
+    if (pc > memory_map::Cartridge0End)
+        return { NoBank, pc };
+    return { static_cast<int>(memory.cartridge.GetROMBank(pc)), pc };
+}
+
+void ExecutionProfile::TrackCalls(const Address pc, const uint8_t opcode, const Address nextPC)
+{
+    switch(opcode) {
+        case 0xcd: // CALL nn
+        case 0xc7: case 0xcf: case 0xd7: case 0xdf: // RST
+        case 0xe7: case 0xef: case 0xf7: case 0xff:
+            Call(GetLocation(nextPC));
+            break;
+        case 0xc4: case 0xcc: case 0xd4: case 0xdc: // CALL cc, nn
+            if (nextPC != static_cast<Address>(pc + 3))
+                Call(GetLocation(nextPC));
+            break;
+        case 0xc9: case 0xd9: // RET, RETI
+            if (depth > 0) --depth;
+            break;
+        case 0xc0: case 0xc8: case 0xd0: case 0xd8: // RET cc
+            if (nextPC != static_cast<Address>(pc + 1) && depth > 0)
+                --depth;
+            break;
+    }
+}
+
+void ExecutionProfile::Clear()
+{
+    for (auto& chunk: chunks)
+        chunk.reset();
+    opcodes.fill({});
+    prefixedOpcodes.fill({});
+    depth = 0;
+}
+
+std::string ExecutionProfile::Disassemble(const Location& location) const
+{
+    std::array<uint8_t, 3> bytes{};
+    if (location.bank == NoBank) {
+        for (size_t n = 0; n < bytes.size(); ++n)
+            bytes[n] = memory.At_u8(location.pc + n);
+    } else {
+        // The bank need not be mapped anymore
+        const auto& rom = memory.cartridge.GetROM();
+        const size_t offset = location.bank * BankSize + (location.pc & (BankSize - 1));
+        for (size_t n = 0; n < bytes.size(); ++n)
+            bytes[n] = offset + n < rom.size() ? rom[offset + n] : 0xff;
+    }
+    return disassembler::Disassemble(location.pc, bytes.data());
+}
+
+std::vector<ExecutionProfile::HotSpot> ExecutionProfile::GetHotSpots(const size_t count, const SortBy sortBy) const
+{
+    std::vector<HotSpot> hotSpots;
+    for (size_t index = 0; index < chunks.size(); ++index) {
+        if (!chunks[index]) continue;
+        const int bank = index < RAMChunks ? NoBank : static_cast<int>(index - RAMChunks);
+        Address base = bank == 0 ? 0x0000 : 0x4000;
+        if (bank == NoBank)
+            base = (index + RAMChunks) * BankSize;
+        const auto& chunk = *chunks[index];
+        for (size_t n = 0; n < chunk.size(); ++n) {
+            if (chunk[n].counter.count != 0)
+                hotSpots.push_back({ { bank, static_cast<Address>(base + n) }, chunk[n].counter, {} });
+        }
+    }
+
+    const auto middle = hotSpots.begin() + std::min(count, hotSpots.size());
+    std::partial_sort(hotSpots.begin(), middle, hotSpots.end(), [&](const auto& a, const auto& b) { return IsLess(b.counter, a.counter, sortBy); });
+    hotSpots.erase(middle, hotSpots.end());
+    for (auto& hotSpot: hotSpots)
+        hotSpot.disassembly = Disassemble(hotSpot.location);
+    return hotSpots;
+}
+
+std::vector<ExecutionProfile::Opcode> ExecutionProfile::GetOpcodes(const SortBy sortBy) const
+{
+    std::vector<Opcode> result;
+    for (int n = 0; n < 256; ++n) {
+        if (opcodes[n].count != 0)
+            result.push_back({ cpu::opcode[n].name, static_cast<uint8_t>(n), false, opcodes[n] });
+        if (prefixedOpcodes[n].count != 0)
+            result.push_back({ cpu::opcode_cb[n].name, static_cast<uint8_t>(n), true, prefixedOpcodes[n] });
+    }
+    std::sort(result.begin(), result.end(), [&](const auto& a, const auto& b) { return IsLess(b.counter, a.counter, sortBy); });
+    return result;
+}
+
+void ExecutionProfile::SaveCollapsedStacks(const std::string& path) const
+{
+    std::ofstream ofs(path);
+    if (!ofs)
+        throw std::runtime_error("unable to create file");
+    for (const auto& hotSpot: GetHotSpots(SIZE_MAX, SortBy::Cycles)) {
+        const auto& chunk = *chunks[GetChunkIndex(hotSpot.location)];
+        const auto& function = chunk[hotSpot.location.pc & (BankSize - 1)].function;
+        ofs << fmt::format("{};{} {} {}\n", ToString(function), ToString(hotSpot.location), hotSpot.disassembly, hotSpot.counter.cycles);
+    }
+    if (!ofs)
+        throw std::runtime_error("write error");
+}
+
+}
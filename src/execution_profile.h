@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "types.h"
+
+namespace gb {
+
+struct Memory;
+
+// Execution counts and cycles of the guest code, per opcode and per
+// instruction address. Every instruction is also accounted to the
+// function it belongs to, as far as a shadow call stack can tell.
+// Recording only touches preallocated counters; the counters of a ROM
+// bank are allocated once code in it runs
+class ExecutionProfile
+{
+public:
+    // Instructions outside of the ROM have no bank
+    static constexpr int NoBank = -1;
+
+    struct Counter {
+        uint64_t count{};
+        uint64_t cycles{};
+    };
+
+    struct Location {
+        int bank{NoBank};
+        Address pc{};
+    };
+
+    struct HotSpot {
+        Location location;
+        Counter counter;
+        std::string disassembly;
+    };
+
+    struct Opcode {
+        std::string_view name;
+        uint8_t opcode{};
+        bool prefixed{};
+        Counter counter;
+    };
+
+    enum class SortBy { Cycles, Count };
+
+    explicit ExecutionProfile(const Memory& memory);
+
+    // Called after every instruction; nextPC is where execution continues,
+    // which tells whether a call or return was taken
+    void Record(const Address pc, const uint8_t opcode, const bool prefixed, const int cycles, const Address nextPC)
+    {
+        const auto location = GetLocation(pc);
+        auto& entry = GetEntry(location);
+        ++entry.counter.count;
+        entry.counter.cycles += cycles;
+        entry.function = stack[depth % stack.size()];
+
+        auto& op = (prefixed ? prefixedOpcodes : opcodes)[opcode];
+        ++op.count;
+        op.cycles += cycles;
+        if (!prefixed)
+            TrackCalls(pc, opcode, nextPC);
+    }
+
+    // An interrupt was dispatched to the given vector
+    void EnterInterrupt(const Address vector)
+    {
+        Call(GetLocation(vector));
+    }
+
+    void Clear();
+
+    std::vector<HotSpot> GetHotSpots(const size_t count, const SortBy sortBy) const;
+    std::vector<Opcode> GetOpcodes(const SortBy sortBy) const;
+
+    // One line per instruction: "function;instruction cycles", which is
+    // the collapsed-stack format flame graph tools take
+    void SaveCollapsedStacks(const std::string& path) const;
+
+private:
+    static constexpr size_t BankSize = 16384;
+    // Everything from 0x8000 on is kept in the first two chunks
+    static constexpr size_t RAMChunks = 2;
+
+    struct Entry {
+        Counter counter;
+        Location function;
+    };
+    using Chunk = std::array<Entry, BankSize>;
+
+    Location GetLocation(const Address pc) const;
+    static size_t GetChunkIndex(const Location& location)
+    {
+        if (location.bank == NoBank)
+            return (location.pc >> 14) - RAMChunks;
+        return location.bank + RAMChunks;
+    }
+    Entry& GetEntry(const Location& location)
+    {
+        auto& chunk = chunks[GetChunkIndex(location)];
+        if (!chunk)
+            chunk = std::make_unique<Chunk>();
+        return (*chunk)[location.pc & (BankSize - 1)];
+    }
+    void TrackCalls(const Address pc, const uint8_t opcode, const Address nextPC);
+    void Call(const Location& function)
+    {
+        ++depth;
+        stack[depth % stack.size()] = function;
+    }
+    std::string Disassemble(const Location& location) const;
+
+    const Memory& memory;
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    std::array<Counter, 256> opcodes{};
+    std::array<Counter, 256> prefixedOpcodes{};
+    // Deeper calls wrap around, losing the outermost ones
+    std::array<Location, 64> stack{};
+    size_t depth{};
+};
+
+}
@@ -0,0 +1,146 @@
+#include "frame_capture.h"
+
+#include <chrono>
+#include <csignal>
+#include <stdexcept>
+
+#include "fmt/core.h"
+
+namespace gb {
+
+namespace {
+    // 4194304 Hz / 70224 cycles per frame, at full chroma resolution
+    const std::string y4mHeader = fmt::format("YUV4MPEG2 W{} H{} F4194304:70224 Ip A1:1 C444\n", resolution::Width, resolution::Height);
+    constexpr size_t PlaneSize = resolution::Width * resolution::Height;
+
+    struct YUV {
+        uint8_t y, u, v;
+    };
+
+    // BT.601 with the limited range, as Y4M players assume
+    YUV ToYUV(const uint32_t rgba)
+    {
+        const double r = rgba & 0xff, g = (rgba >> 8) & 0xff, b = (rgba >> 16) & 0xff;
+        return {
+            static_cast<uint8_t>(16.5 + (65.481 * r + 128.553 * g + 24.966 * b) / 255),
+            static_cast<uint8_t>(128.5 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255),
+            static_cast<uint8_t>(128.5 + (112.0 * r - 93.786 * g - 18.214 * b) / 255)
+        };
+    }
+}
+
+FrameCapture::FrameCapture(Video& video, const std::string& path, const Overflow overflow)
+    : video(video), overflow(overflow)
+{
+    pipe = !path.empty() && path[0] == '|';
+    if (pipe) {
+        // Otherwise a command which quits early would take the emulator
+        // with it; the failed writes are noticed instead
+        std::signal(SIGPIPE, SIG_IGN);
+        output = popen(path.c_str() + 1, "w");
+    } else {
+        output = std::fopen(path.c_str(), "wb");
+    }
+    if (!output)
+        throw std::runtime_error("cannot create '" + path + "'");
+    if (std::fwrite(y4mHeader.data(), 1, y4mHeader.size(), output) != y4mHeader.size()) {
+        pipe ? pclose(output) : std::fclose(output);
+        throw std::runtime_error("cannot write to '" + path + "'");
+    }
+
+    pool = std::make_unique<std::array<FrameBuffer, PoolSize>>();
+    video.SetNextFrameBuffer(&(*pool)[0]);
+    thread = std::thread([this]() { Worker(); });
+}
+
+FrameCapture::~FrameCapture()
+{
+    Finish();
+}
+
+void FrameCapture::Finish()
+{
+    if (!output)
+        return;
+    video.ReleaseFrameBuffer();
+    terminating = true;
+    thread.join();
+    Drain();
+    // pclose() returns the exit status of the command
+    if ((pipe ? pclose(output) : std::fclose(output)) != 0)
+        writeError = true;
+    output = nullptr;
+}
+
+void FrameCapture::OnFrame()
+{
+    const size_t n = submitted.load(std::memory_order_relaxed);
+    auto& frame = (*pool)[n % PoolSize];
+    // Only if capturing started in the middle of a frame
+    if (&video.GetFrameBuffer() != &frame)
+        frame = video.GetFrameBuffer();
+
+    // The next frame goes to the slot after this one, which the writer
+    // must be done with
+    while (n + 1 - written.load(std::memory_order_acquire) >= PoolSize) {
+        if (overflow == Overflow::Drop) {
+            // The next frame overwrites this one
+            ++droppedFrames;
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    video.SetNextFrameBuffer(&(*pool)[(n + 1) % PoolSize]);
+    submitted.store(n + 1, std::memory_order_release);
+}
+
+bool FrameCapture::Drain()
+{
+    const auto end = submitted.load(std::memory_order_acquire);
+    auto n = written.load(std::memory_order_relaxed);
+    if (n == end)
+        return false;
+    for (; n != end; ++n) {
+        WriteFrame((*pool)[n % PoolSize]);
+        written.store(n + 1, std::memory_order_release);
+    }
+    return true;
+}
+
+void FrameCapture::WriteFrame(const FrameBuffer& frame)
+{
+    // After a write error, frames are only consumed, so OnFrame() never
+    // waits for them
+    if (writeError)
+        return;
+
+    static const auto shades = []() {
+        std::array<uint32_t, 4> rgba;
+        GetRGBAPalette(rgba.data());
+        return std::array<YUV, 4>{ ToYUV(rgba[0]), ToYUV(rgba[1]), ToYUV(rgba[2]), ToYUV(rgba[3]) };
+    }();
+
+    static constexpr char frameHeader[] = "FRAME\n";
+    std::array<uint8_t, sizeof(frameHeader) - 1 + 3 * PlaneSize> buffer;
+    std::copy(frameHeader, frameHeader + sizeof(frameHeader) - 1, buffer.begin());
+    auto y = buffer.begin() + sizeof(frameHeader) - 1;
+    auto u = y + PlaneSize, v = u + PlaneSize;
+    for (size_t n = 0; n < PlaneSize; ++n) {
+        const auto& yuv = shades[frame[n] & 3];
+        y[n] = yuv.y;
+        u[n] = yuv.u;
+        v[n] = yuv.v;
+    }
+    if (std::fwrite(buffer.data(), 1, buffer.size(), output) != buffer.size())
+        writeError = true;
+}
+
+void FrameCapture::Worker()
+{
+    while (!terminating) {
+        if (!Drain())
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include "video.h"
+
+namespace gb {
+
+// Records every frame the machine renders as a Y4M video, either to a file
+// or to the standard input of a command (such as ffmpeg) which encodes it.
+// Video renders straight into a preallocated pool of framebuffers, which
+// are handed to a writer thread as they complete, so the emulation thread
+// neither allocates nor copies. The audio can be recorded alongside with a
+// WavWriter
+class FrameCapture
+{
+public:
+    // What OnFrame() does when the writer has fallen behind by the whole pool
+    enum class Overflow {
+        Drop, // lose the frame; the video ends up shorter
+        Wait  // hold the emulation until a framebuffer is free
+    };
+
+    // A path starting with '|' names a shell command to pipe the video to
+    // instead, like "|ffmpeg -i - run.mp4". Throws std::runtime_error if
+    // the output cannot be opened
+    FrameCapture(Video& video, const std::string& path, const Overflow overflow);
+    // Calls Finish()
+    ~FrameCapture();
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Call whenever the render flag was set, i.e. video holds a complete frame
+    void OnFrame();
+
+    // Writes the pending frames, detaches from video and closes the output;
+    // OnFrame() must not be called afterwards
+    void Finish();
+
+    size_t GetNumberOfFrames() const { return submitted; }
+    size_t GetNumberOfDroppedFrames() const { return droppedFrames; }
+    // Whether a frame could not be written, or the output, such as the
+    // command piped to, did not close successfully. Only final after Finish()
+    bool HasWriteError() const { return writeError; }
+
+private:
+    // Enough for half a second of frames
+    static constexpr size_t PoolSize = 32;
+
+    void Worker();
+    // Returns whether any frame was written
+    bool Drain();
+    void WriteFrame(const FrameBuffer& frame);
+
+    Video& video;
+    const Overflow overflow;
+    bool pipe{};
+    std::FILE* output{};
+    std::unique_ptr<std::array<FrameBuffer, PoolSize>> pool;
+    // The frames are used round robin: the pool slot of frame n is
+    // n % PoolSize. Only ever increasing
+    alignas(64) std::atomic<size_t> submitted{};
+    alignas(64) std::atomic<size_t> written{};
+    size_t droppedFrames{};
+    std::atomic<bool> writeError{};
+    std::atomic<bool> terminating{};
+    std::thread thread;
+};
+
+}
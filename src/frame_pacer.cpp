@@ -0,0 +1,54 @@
+#include "frame_pacer.h"
+
+#include <thread>
+
+namespace gb {
+
+namespace {
+    const auto FrameDuration = std::chrono::duration_cast<FramePacer::Clock::duration>(std::chrono::duration<double>(1.0 / FramePacer::FrameRate));
+    // Sleeping may overshoot by about this much
+    constexpr auto SpinDuration = std::chrono::milliseconds(2);
+    // Beyond this, the lost time is given up instead of catching up with
+    // a burst of frames
+    constexpr int MaxFramesBehind = 3;
+}
+
+FramePacer::FramePacer()
+    : deadline(Clock::now() + FrameDuration), measureStart(Clock::now())
+{
+}
+
+void FramePacer::SetMode(const Mode m)
+{
+    if (m == mode) return;
+    mode = m;
+    deadline = Clock::now() + FrameDuration;
+}
+
+bool FramePacer::NextFrame()
+{
+    const auto now = Clock::now();
+    ++measureFrames;
+    if (const auto elapsed = now - measureStart; elapsed >= std::chrono::seconds(1)) {
+        measuredFrameRate = measureFrames / std::chrono::duration<double>(elapsed).count();
+        measureStart = now;
+        measureFrames = 0;
+    }
+    return frameCount++ % frameSkip == 0;
+}
+
+void FramePacer::Wait()
+{
+    if (mode == Mode::Turbo) return;
+
+    auto now = Clock::now();
+    if (now - deadline > MaxFramesBehind * FrameDuration)
+        deadline = now;
+    if (deadline - now > SpinDuration)
+        std::this_thread::sleep_for(deadline - now - SpinDuration);
+    while (Clock::now() < deadline)
+        std::this_thread::yield();
+    deadline += FrameDuration;
+}
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+
+namespace gb {
+
+// Decides which emulated frames are presented and, in real time mode,
+// holds every frame until it is due on real hardware
+class FramePacer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // 4194304 Hz / 70224 cycles per frame
+    static constexpr double FrameRate = 4'194'304.0 / (154 * 456);
+
+    enum class Mode {
+        RealTime,
+        Turbo // as fast as possible
+    };
+
+    FramePacer();
+
+    void SetMode(const Mode mode);
+    Mode GetMode() const { return mode; }
+    // Presents only every nth frame; all frames are still emulated
+    void SetFrameSkip(const int n) { frameSkip = n < 1 ? 1 : n; }
+    int GetFrameSkip() const { return frameSkip; }
+
+    // Called once per emulated frame; returns whether to present it
+    bool NextFrame();
+    // In real time mode, sleeps until shortly before the end of the
+    // current frame and spins for the rest, as sleeping is too coarse
+    void Wait();
+
+    // Frames emulated per second, measured over the last second
+    double GetFrameRate() const { return measuredFrameRate; }
+
+private:
+    Mode mode{Mode::RealTime};
+    int frameSkip{1};
+    unsigned int frameCount{};
+    Clock::time_point deadline;
+
+    Clock::time_point measureStart;
+    unsigned int measureFrames{};
+    double measuredFrameRate{};
+};
+
+}
@@ -0,0 +1,26 @@
+#include "differential.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+// libFuzzer entry point: the input is a cartridge, run through both CPU
+// paths in lock-step; any difference aborts, so it is kept as a crash
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    gb::differential::Options options;
+    // Short runs keep the fuzzer exploring
+    options.maxInstructions = 100'000;
+    options.memoryInterval = 64;
+    try {
+        const auto rom = std::make_shared<gb::ROM>(gb::differential::MakeCartridge(data, size));
+        const auto outcome = gb::differential::Run(rom, options);
+        if (!outcome.mismatch.empty()) {
+            std::cerr << outcome.mismatch << "\n";
+            std::abort();
+        }
+    } catch (std::exception&) {
+        // Cartridges the emulator refuses are of no interest
+    }
+    return 0;
+}
@@ -1,9 +1,11 @@
 #include "gui.h"
 #include "imgui.h"
 #include "imgui-SFML.h"
-#include <deque>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <vector>
+#include "frame_pacer.h"
 #include "io.h"
 #include "types.h"
 
@@ -33,20 +35,112 @@ namespace {
 
     sf::Color backgroundColor;
 
-    constexpr int fps = 60;
-    constexpr int numberOfSamples = fps * 60;
-    using ChannelSamples = std::deque<float>;
-    std::array<ChannelSamples, 4> audio_samples;
+    Controls* controls{};
+    // Mode chosen in the speed window, overridden while space is held
+    bool selectedTurbo{};
+    // Frame shown while scrubbing; the machine is paused while set
+    std::optional<int> rewindPosition;
+    const ProfileReport* profileReport{};
+    const AudioScope::Snapshot* scope{};
+
+    // A column header which sorts the table when clicked
+    void SortHeader(const char* label, const ExecutionProfile::SortBy sortBy)
+    {
+        if (ImGui::Selectable(label, controls->profileSortBy == sortBy))
+            controls->profileSortBy = sortBy;
+        ImGui::NextColumn();
+    }
+
+    // The snapshot is a ring, which PlotLines() starts reading at offset
+    void ShowAudioScope()
+    {
+        if (const auto snapshot = controls->scope.Consume(); snapshot)
+            scope = snapshot;
+        if (!scope)
+            return;
+        ImGui::Begin("Audio");
+        constexpr std::array names{ "Left", "Right" };
+        for (size_t ch = 0; ch < scope->channels.size(); ++ch)
+            ImGui::PlotLines(names[ch], scope->channels[ch].data(), AudioScope::Length, scope->offset, nullptr, -1.0f, 1.0f, ImVec2(0, 80));
+        ImGui::End();
+    }
+
+    void ShowProfiler()
+    {
+        using SortBy = ExecutionProfile::SortBy;
+        ImGui::Begin("Profiler");
+        bool profiling = controls->profiling;
+        if (ImGui::Checkbox("Profile", &profiling))
+            controls->profiling = profiling;
+        ImGui::SameLine();
+        if (ImGui::Button("Clear"))
+            controls->clearProfile = true;
+        ImGui::SameLine();
+        if (ImGui::Button("Export"))
+            controls->exportProfile = true;
+
+        if (const auto report = controls->profile.Consume(); report)
+            profileReport = report;
+        if (!profileReport) {
+            ImGui::End();
+            return;
+        }
+        if (!profileReport->status.empty())
+            ImGui::Text("%s", profileReport->status.c_str());
+        const auto share = [&](const uint64_t cycles) {
+            return profileReport->cycles ? 100.0 * cycles / profileReport->cycles : 0.0;
+        };
+
+        if (ImGui::CollapsingHeader("Hot spots")) {
+            ImGui::Columns(4, "hotspots");
+            ImGui::Text("Address"); ImGui::NextColumn();
+            ImGui::Text("Instruction"); ImGui::NextColumn();
+            SortHeader("Count", SortBy::Count);
+            SortHeader("Cycles", SortBy::Cycles);
+            ImGui::Separator();
+            for (const auto& hotSpot: profileReport->hotSpots) {
+                const auto& location = hotSpot.location;
+                if (location.bank == ExecutionProfile::NoBank)
+                    ImGui::Text("%04x", location.pc);
+                else
+                    ImGui::Text("%02x:%04x", location.bank, location.pc);
+                ImGui::NextColumn();
+                ImGui::Text("%s", hotSpot.disassembly.c_str()); ImGui::NextColumn();
+                ImGui::Text("%llu", static_cast<unsigned long long>(hotSpot.counter.count)); ImGui::NextColumn();
+                ImGui::Text("%llu (%.1f%%)", static_cast<unsigned long long>(hotSpot.counter.cycles), share(hotSpot.counter.cycles)); ImGui::NextColumn();
+            }
+            ImGui::Columns(1);
+        }
+
+        if (ImGui::CollapsingHeader("Opcodes")) {
+            ImGui::Columns(4, "opcodes");
+            ImGui::Text("Opcode"); ImGui::NextColumn();
+            ImGui::Text("Instruction"); ImGui::NextColumn();
+            SortHeader("Count##opcodes", SortBy::Count);
+            SortHeader("Cycles##opcodes", SortBy::Cycles);
+            ImGui::Separator();
+            for (const auto& opcode: profileReport->opcodes) {
+                ImGui::Text(opcode.prefixed ? "cb %02x" : "%02x", opcode.opcode); ImGui::NextColumn();
+                ImGui::Text("%.*s", static_cast<int>(opcode.name.size()), opcode.name.data()); ImGui::NextColumn();
+                ImGui::Text("%llu", static_cast<unsigned long long>(opcode.counter.count)); ImGui::NextColumn();
+                ImGui::Text("%llu (%.1f%%)", static_cast<unsigned long long>(opcode.counter.cycles), share(opcode.counter.cycles)); ImGui::NextColumn();
+            }
+            ImGui::Columns(1);
+        }
+        ImGui::End();
+    }
 }
 
-void Init()
+void Init(Controls& c)
 {
-    for(auto& as: audio_samples)
-        as.resize(numberOfSamples);
+    controls = &c;
+    selectedTurbo = controls->turbo;
 
     window = std::make_unique<sf::RenderWindow>(sf::VideoMode(800, 600), "GBEMU");
     ImGui::SFML::Init(*window);
-    //window->setFramerateLimit(60);
+    // The emulation runs on its own thread, paced by gb::FramePacer; this
+    // only limits how often the UI is drawn
+    window->setFramerateLimit(60);
 
     texture = std::make_unique<sf::Texture>();
     texture->create(resolution::Width, resolution::Height);
@@ -54,6 +148,9 @@ void Init()
 
 void Cleanup()
 {
+    controls = nullptr;
+    profileReport = nullptr;
+    scope = nullptr;
     window.release();
     ImGui::SFML::Shutdown();
 }
@@ -70,26 +167,42 @@ void Render()
         ImGui::End();
     }
 
-    // 2. Show a simple window that we create ourselves. We use a Begin/End pair to created a named window.
-    if (0) {
-        static float f = 0.0f;
-        static int counter = 0;
-
-        ImGui::Begin("Audio!");
-
-        for(int ch = 0; ch < static_cast<int>(audio_samples.size()); ++ch) {
-            const auto& as = audio_samples[ch];
-            std::vector<float> samples;
-            samples.reserve(as.size());
-            std::copy(as.begin(), as.end(), std::back_inserter(samples));
+    {
+        ImGui::Begin("Speed");
+        int turbo = selectedTurbo ? 1 : 0;
+        ImGui::RadioButton("Real time", &turbo, 0);
+        ImGui::SameLine();
+        ImGui::RadioButton("Turbo", &turbo, 1);
+        selectedTurbo = turbo != 0;
+        int frameSkip = controls->frameSkip;
+        if (ImGui::SliderInt("Show every nth frame", &frameSkip, 1, 10))
+            controls->frameSkip = frameSkip;
+        const double frameRate = controls->frameRate;
+        ImGui::Text("%.1f frames/s (%.1fx)", frameRate, frameRate / FramePacer::FrameRate);
+        ImGui::End();
+    }
 
-            char name[64];
-            sprintf(name, "Channel %d", ch + 1);
-            ImGui::PlotLines(name, samples.data(), samples.size(), 0, 0, -1.0f, 1.0f, ImVec2(0,80));
+    if (const int rewindFrames = controls->rewindFrames; rewindFrames > 0) {
+        ImGui::Begin("Rewind");
+        const int lastFrame = rewindFrames - 1;
+        int position = rewindPosition.value_or(lastFrame);
+        if (ImGui::SliderInt("Frame", &position, 0, lastFrame)) {
+            rewindPosition = position;
+            controls->paused = true;
+            controls->restoreFrame = position;
         }
-
+        if (rewindPosition && ImGui::Button("Resume")) {
+            rewindPosition.reset();
+            controls->paused = false;
+        }
+        ImGui::Text("%d frames (%.1f s), %.1f MiB", rewindFrames, rewindFrames / FramePacer::FrameRate, controls->rewindMemoryUsage / (1024.0 * 1024.0));
         ImGui::End();
     }
+
+    ShowProfiler();
+
+    ShowAudioScope();
+
     if (0) {
         static bool b;
         ImGui::ShowDemoWindow(&b);
@@ -100,27 +213,25 @@ void Render()
     window->display();
 }
 
-void UpdateTexture(const char* framebuffer)
+void UpdateTexture()
 {
-    texture->update(reinterpret_cast<const sf::Uint8*>(framebuffer), resolution::Width, resolution::Height, 0, 0);
-}
-
-void OnAudioSample(const int ch, const float sample)
-{
-    if (ch < 0 || ch >= static_cast<int>(audio_samples.size()))
-        return;
-    auto& as = audio_samples[ch];
-    as.pop_front();
-    as.push_back(sample);
+    // Only the frames which are presented get converted
+    static std::array<uint32_t, resolution::Width * resolution::Height> rgba;
+    if (const auto frame = controls->frames.Consume(); frame) {
+        ConvertToRGBA(*frame, rgba.data());
+        texture->update(reinterpret_cast<const sf::Uint8*>(rgba.data()), resolution::Width, resolution::Height, 0, 0);
+    }
 }
 
-bool HandleEvents(IO& io)
+bool HandleEvents()
 {
-    io.buttonPressed = 0;
+    uint8_t buttons = 0;
     for (const auto [ key, button ]: keyToButtonMappings) {
         if (sf::Keyboard::isKeyPressed(key))
-            io.buttonPressed |= button;
+            buttons |= button;
     }
+    controls->buttons = buttons;
+    controls->turbo = selectedTurbo || sf::Keyboard::isKeyPressed(sf::Keyboard::Space);
 
     sf::Event event;
     while(window->pollEvent(event)) {
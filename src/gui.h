@@ -1,19 +1,63 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "audio_scope.h"
+#include "execution_profile.h"
+#include "triple_buffer.h"
+#include "types.h"
+#include "video.h"
 
 namespace gb {
-class IO;
 namespace gui {
 
-void InitGL();
-void Init();
+// What the profiler window shows, as of the last report
+struct ProfileReport {
+    std::vector<ExecutionProfile::HotSpot> hotSpots;
+    std::vector<ExecutionProfile::Opcode> opcodes;
+    uint64_t cycles{};
+    // Outcome of the last export
+    std::string status;
+};
+
+// Everything exchanged between the UI thread and the emulation thread.
+// The UI never touches the machine itself, so neither waits for the other
+struct Controls {
+    // UI to emulation
+    std::atomic<uint8_t> buttons{};
+    std::atomic<bool> quit{};
+    std::atomic<bool> turbo{};
+    std::atomic<int> frameSkip{1};
+    // While paused, the machine shows the recorded frame restoreFrame is
+    // set to; it is reset to -1 once restored
+    std::atomic<bool> paused{};
+    std::atomic<int> restoreFrame{-1};
+    // Execution profiling; the requests are reset once handled
+    std::atomic<bool> profiling{};
+    std::atomic<bool> clearProfile{};
+    std::atomic<bool> exportProfile{};
+    std::atomic<ExecutionProfile::SortBy> profileSortBy{ExecutionProfile::SortBy::Cycles};
+
+    // Emulation to UI
+    TripleBuffer<FrameBuffer> frames;
+    std::atomic<double> frameRate{};
+    std::atomic<int> rewindFrames{};
+    std::atomic<size_t> rewindMemoryUsage{};
+    TripleBuffer<ProfileReport> profile;
+    TripleBuffer<AudioScope::Snapshot> scope;
+};
+
+void Init(Controls& controls);
 void Cleanup();
 void Render();
-void UpdateTexture(const char*);
-bool HandleEvents(IO&);
-
-void OnAudioSample(const int ch, const float sample);
+// Picks up the latest published frame, if any
+void UpdateTexture();
+// Returns false once the window is closed
+bool HandleEvents();
 
 }
-}
\ No newline at end of file
+}
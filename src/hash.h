@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace gb {
+    // FNV-1a, processing 8 bytes at a time
+    inline uint64_t CalculateHash(const uint8_t* data, const size_t length)
+    {
+        constexpr uint64_t prime = 0x100000001b3;
+        uint64_t hash = 0xcbf29ce484222325;
+        size_t n = 0;
+        for (; n + sizeof(uint64_t) <= length; n += sizeof(uint64_t)) {
+            uint64_t v;
+            memcpy(&v, &data[n], sizeof(v));
+            hash = (hash ^ v) * prime;
+        }
+        for (; n < length; ++n)
+            hash = (hash ^ data[n]) * prime;
+        return (hash ^ length) * prime;
+    }
+}
@@ -0,0 +1,351 @@
+#include "cartridge.h"
+#include "frame_capture.h"
+#include "movie.h"
+#include "system.h"
+#include "thread_pool.h"
+#include "wav_writer.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string_view>
+#include <unistd.h>
+
+#include "fmt/core.h"
+
+namespace {
+
+long optionFrames = 0;
+long long optionCycles = 0;
+bool optionBootROM = false;
+unsigned int optionThreads = 0;
+std::string optionFrameBufferPath;
+std::string optionSerialPath;
+std::string optionWavPath;
+std::string optionVideoPath;
+std::string optionTracePath;
+std::string optionLoadStatePath;
+std::string optionSaveStatePath;
+std::string optionMoviePath;
+std::string optionProfilePath;
+bool optionTraceMemory = false;
+bool optionSerialResult = false;
+std::vector<std::string> romPaths;
+
+bool ProcessOptions(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "h?bmxf:n:o:s:w:v:t:j:L:S:p:P:")) != -1) {
+        switch(opt) {
+            case 'h':
+            case '?':
+                std::cout << fmt::format("usage: {} [-h?bmx] [-f frames] [-n cycles] [-o frame.ppm] [-s serial.txt] [-w audio.wav] [-v video.y4m] [-t file.trace] [-L in.state] [-S out.state] [-p movie.gbm] [-P file.folded] [-j threads] cartridge.gb ...\n\n", argv[0]);
+                std::cout << fmt::format("  -h, -?     this help\n");
+                std::cout << fmt::format("  -b         enable bootrom emulation\n");
+                std::cout << fmt::format("  -f frames  stop after the given number of frames\n");
+                std::cout << fmt::format("  -n cycles  stop after the given number of clock cycles\n");
+                std::cout << fmt::format("  -o file    write the final framebuffer to file (PPM)\n");
+                std::cout << fmt::format("  -s file    write serial output to file instead of stdout\n");
+                std::cout << fmt::format("  -x         stop as soon as the serial output says \"Passed\" or \"Failed\",\n");
+                std::cout << fmt::format("             as test ROMs do; exits with 2 if any failed, else with 3 if\n");
+                std::cout << fmt::format("             any reached the limit without a verdict\n");
+                std::cout << fmt::format("  -w file    write audio to file (WAV)\n");
+                std::cout << fmt::format("  -v file    write every frame to file (Y4M); \"|command\" pipes them to\n");
+                std::cout << fmt::format("             the command instead, e.g. \"|ffmpeg -i - run.mp4\"\n");
+                std::cout << fmt::format("  -t file    write the last instructions executed to file (trace)\n");
+                std::cout << fmt::format("  -m         trace memory access as well (needs -t)\n");
+                std::cout << fmt::format("  -L file    start from the machine state in file instead of resetting\n");
+                std::cout << fmt::format("  -S file    write the final machine state to file\n");
+                std::cout << fmt::format("  -p file    replay the input movie in file, checking its framebuffer\n");
+                std::cout << fmt::format("             hashes; runs for the length of the movie unless -f/-n is given\n");
+                std::cout << fmt::format("  -P file    write the cycles spent per instruction to file, as collapsed\n");
+                std::cout << fmt::format("             stacks (one \"function;instruction cycles\" line each)\n");
+                std::cout << fmt::format("  -j threads number of machines to run in parallel (default: all cores)\n\n");
+                std::cout << fmt::format("When multiple cartridges are given, -o, -s, -w, -v, -t, -L, -S, -p and -P\n");
+                std::cout << fmt::format("name directories which contain a <cartridge>.ppm, .txt, .wav, .y4m, .trace,\n");
+                std::cout << fmt::format(".state, .gbm or .folded file per cartridge.\n");
+                return false;
+            case 'b':
+                optionBootROM = true;
+                break;
+            case 'f':
+                optionFrames = std::stol(optarg);
+                break;
+            case 'n':
+                optionCycles = std::stoll(optarg);
+                break;
+            case 'o':
+                optionFrameBufferPath = optarg;
+                break;
+            case 's':
+                optionSerialPath = optarg;
+                break;
+            case 'w':
+                optionWavPath = optarg;
+                break;
+            case 'v':
+                optionVideoPath = optarg;
+                break;
+            case 't':
+                optionTracePath = optarg;
+                break;
+            case 'm':
+                optionTraceMemory = true;
+                break;
+            case 'x':
+                optionSerialResult = true;
+                break;
+            case 'j':
+                optionThreads = std::stoul(optarg);
+                break;
+            case 'L':
+                optionLoadStatePath = optarg;
+                break;
+            case 'S':
+                optionSaveStatePath = optarg;
+                break;
+            case 'p':
+                optionMoviePath = optarg;
+                break;
+            case 'P':
+                optionProfilePath = optarg;
+                break;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cout << fmt::format("expected cartridge.gb file after options\n");
+        return false;
+    }
+    if (optionTraceMemory && optionTracePath.empty()) {
+        std::cout << fmt::format("-m needs a trace file (-t)\n");
+        return false;
+    }
+    if (!optionMoviePath.empty() && !optionLoadStatePath.empty()) {
+        std::cout << fmt::format("movies (-p) start from reset, not from a state (-L)\n");
+        return false;
+    }
+    if (optionFrames <= 0 && optionCycles <= 0 && optionMoviePath.empty()) {
+        std::cout << fmt::format("expected a frame (-f) or cycle (-n) limit\n");
+        return false;
+    }
+
+    for(int n = optind; n < argc; ++n)
+        romPaths.push_back(argv[n]);
+    if (romPaths.size() > 1 && !optionVideoPath.empty() && optionVideoPath[0] == '|') {
+        std::cout << fmt::format("video can only be piped (-v |command) for a single cartridge\n");
+        return false;
+    }
+    return true;
+}
+
+void WriteFrameBuffer(const std::string& path, const gb::FrameBuffer& frameBuffer)
+{
+    std::vector<uint32_t> rgba(frameBuffer.size());
+    gb::ConvertToRGBA(frameBuffer, rgba.data());
+
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << fmt::format("P6\n{} {}\n255\n", gb::resolution::Width, gb::resolution::Height);
+    for(const auto pixel: rgba) {
+        // PPM wants RGB
+        const char rgb[3] = { static_cast<char>(pixel), static_cast<char>(pixel >> 8), static_cast<char>(pixel >> 16) };
+        ofs.write(rgb, sizeof(rgb));
+    }
+    if (!ofs)
+        throw std::runtime_error("write error");
+}
+
+void WriteSerialOutput(const std::string& path, const std::string& serialOutput)
+{
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << serialOutput;
+    if (!ofs)
+        throw std::runtime_error("write error");
+}
+
+std::string GetOutputPath(const std::string& option, const std::string& romPath, const char* extension)
+{
+    if (romPaths.size() == 1)
+        return option;
+    const auto fileName = std::filesystem::path(romPath).stem().string() + extension;
+    return (std::filesystem::path(option) / fileName).string();
+}
+
+// TimedOut: the frame or cycle limit came first
+enum class Verdict { None, Passed, Failed, TimedOut };
+
+struct Result {
+    Verdict verdict{};
+    long frames{};
+    long long cycles{};
+    size_t checkpoints{};
+    std::string serialOutput;
+    std::string error;
+};
+
+Result Run(const std::string& romPath, std::shared_ptr<const gb::ROM> rom)
+{
+    Result result;
+    try {
+        gb::System system(std::move(rom));
+        if (!optionWavPath.empty())
+            system.audio.SetSink(std::make_shared<gb::WavWriter>(GetOutputPath(optionWavPath, romPath, ".wav"), gb::WavWriter::Overflow::Wait));
+        // Every frame is kept, however long the writer takes
+        std::unique_ptr<gb::FrameCapture> capture;
+        if (!optionVideoPath.empty())
+            capture = std::make_unique<gb::FrameCapture>(system.video, GetOutputPath(optionVideoPath, romPath, ".y4m"), gb::FrameCapture::Overflow::Wait);
+        std::unique_ptr<gb::trace::Buffer> trace;
+        if (!optionTracePath.empty()) {
+            trace = std::make_unique<gb::trace::Buffer>();
+            system.SetTrace(trace.get(), optionTraceMemory);
+        }
+        // Nothing looks at the frames otherwise
+        if (optionFrameBufferPath.empty() && optionVideoPath.empty() && optionMoviePath.empty() && optionSaveStatePath.empty() && optionTracePath.empty())
+            system.video.SetRendering(false);
+        if (optionSerialResult) {
+            system.io.onSerialByte = [&](const uint8_t) {
+                const std::string_view output = system.io.serialOutput;
+                if (output.size() >= 6 && output.compare(output.size() - 6, 6, "Passed") == 0)
+                    result.verdict = Verdict::Passed;
+                else if (output.size() >= 6 && output.compare(output.size() - 6, 6, "Failed") == 0)
+                    result.verdict = Verdict::Failed;
+            };
+        }
+        std::unique_ptr<gb::ExecutionProfile> profile;
+        if (!optionProfilePath.empty()) {
+            profile = std::make_unique<gb::ExecutionProfile>(system.memory);
+            system.SetExecutionProfile(profile.get());
+        }
+
+        std::optional<gb::Movie> movie;
+        auto frames = optionFrames;
+        if (!optionMoviePath.empty()) {
+            movie = gb::Movie::Load(GetOutputPath(optionMoviePath, romPath, ".gbm"));
+            if (movie->romHash != system.cartridge.GetROM().GetHash())
+                throw std::runtime_error("movie belongs to a different cartridge");
+            if (optionFrames <= 0 && optionCycles <= 0)
+                frames = movie->length;
+            if (frames <= 0 && optionCycles <= 0)
+                throw std::runtime_error("movie is empty");
+        }
+
+        if (!optionLoadStatePath.empty())
+            system.LoadState(gb::state::Load(GetOutputPath(optionLoadStatePath, romPath, ".state")));
+        else
+            system.Reset(movie ? movie->bootROM : optionBootROM);
+
+        // Feeds the movie at the start of every frame, as it was recorded
+        std::optional<gb::MoviePlayer> player;
+        const auto replayMovie = [&]() {
+            system.io.buttonPressed = player->StartFrame(result.frames, system.video.GetFrameBuffer());
+        };
+        if (movie) {
+            player.emplace(*movie);
+            replayMovie();
+        }
+
+        while((frames <= 0 || result.frames < frames) && (optionCycles <= 0 || result.cycles < optionCycles) && (!player || player->GetMismatch().empty()) && result.verdict == Verdict::None) {
+            auto budget = gb::System::CyclesPerFrame;
+            if (optionCycles > 0)
+                budget = static_cast<int>(std::min<long long>(budget, optionCycles - result.cycles));
+            result.cycles += system.Run(budget);
+            if (system.video.GetRenderFlagAndReset()) {
+                ++result.frames;
+                if (player)
+                    replayMovie();
+                if (capture)
+                    capture->OnFrame();
+            }
+        }
+        if (optionSerialResult && result.verdict == Verdict::None && (!player || player->GetMismatch().empty()))
+            result.verdict = Verdict::TimedOut;
+
+        system.audio.Sync();
+        if (capture) {
+            capture->Finish();
+            if (capture->HasWriteError())
+                throw std::runtime_error("video capture failed");
+        }
+        result.serialOutput = system.io.serialOutput;
+        if (!optionFrameBufferPath.empty())
+            WriteFrameBuffer(GetOutputPath(optionFrameBufferPath, romPath, ".ppm"), system.video.GetFrameBuffer());
+        if (!optionSerialPath.empty())
+            WriteSerialOutput(GetOutputPath(optionSerialPath, romPath, ".txt"), result.serialOutput);
+        if (!optionSaveStatePath.empty())
+            gb::state::Save(GetOutputPath(optionSaveStatePath, romPath, ".state"), system.SaveState());
+        if (trace)
+            trace->Save(GetOutputPath(optionTracePath, romPath, ".trace"));
+        if (profile)
+            profile->SaveCollapsedStacks(GetOutputPath(optionProfilePath, romPath, ".folded"));
+        // The outputs show where the replay diverged
+        if (player) {
+            result.checkpoints = player->GetNumberOfMatchedCheckpoints();
+            result.error = player->GetMismatch();
+        }
+    } catch (std::exception& e) {
+        result.error = e.what();
+    }
+    return result;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    if (!ProcessOptions(argc, argv)) return 1;
+
+    // Every ROM is only loaded once, even if it is listed multiple times
+    std::map<std::string, std::shared_ptr<const gb::ROM>> roms;
+    for(const auto& path: romPaths) {
+        if (roms.count(path)) continue;
+        try {
+            roms[path] = gb::LoadROM(path);
+        } catch (std::exception& e) {
+            std::cout << fmt::format("cannot load '{}': {}\n", path, e.what());
+            return 1;
+        }
+    }
+
+    std::vector<Result> results(romPaths.size());
+    {
+        gb::ThreadPool pool(optionThreads);
+        for(size_t n = 0; n < romPaths.size(); ++n) {
+            pool.Submit([&, n]() {
+                results[n] = Run(romPaths[n], roms.at(romPaths[n]));
+            });
+        }
+        pool.Wait();
+    }
+
+    int exitCode = 0;
+    for(size_t n = 0; n < romPaths.size(); ++n) {
+        const auto& result = results[n];
+        if (!result.error.empty()) {
+            std::cout << fmt::format("{}: {}\n", romPaths[n], result.error);
+            exitCode = 1;
+            continue;
+        }
+        if (optionSerialPath.empty()) {
+            if (romPaths.size() > 1)
+                std::cout << fmt::format("{}: ", romPaths[n]);
+            std::cout << result.serialOutput << "\n";
+        }
+        if (optionSerialResult && result.verdict == Verdict::Failed) {
+            std::cout << fmt::format("{}: failed\n", romPaths[n]);
+            if (exitCode == 0 || exitCode == 3)
+                exitCode = 2;
+        } else if (optionSerialResult && result.verdict != Verdict::Passed) {
+            std::cout << fmt::format("{}: timed out after {} frames, {} cycles without a verdict\n", romPaths[n], result.frames, result.cycles);
+            if (exitCode == 0)
+                exitCode = 3;
+        }
+        if (!optionMoviePath.empty())
+            std::cerr << fmt::format("{}: {} frames, {} cycles, {} checkpoints match\n", romPaths[n], result.frames, result.cycles, result.checkpoints);
+        else
+            std::cerr << fmt::format("{}: {} frames, {} cycles\n", romPaths[n], result.frames, result.cycles);
+    }
+    return exitCode;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "cpu.h"
+
+// The handlers in opcode[] and opcode_cb[] are selected through a switch
+// with a constant index, so the compiler sees the exact lambda and can
+// inline it instead of calling through Instruction::func
+#define GB_DISPATCH(table, n) case n: return table[n].func(regs, mem);
+#define GB_DISPATCH_16(table, n) \
+    GB_DISPATCH(table, n + 0x0) GB_DISPATCH(table, n + 0x1) GB_DISPATCH(table, n + 0x2) GB_DISPATCH(table, n + 0x3) \
+    GB_DISPATCH(table, n + 0x4) GB_DISPATCH(table, n + 0x5) GB_DISPATCH(table, n + 0x6) GB_DISPATCH(table, n + 0x7) \
+    GB_DISPATCH(table, n + 0x8) GB_DISPATCH(table, n + 0x9) GB_DISPATCH(table, n + 0xa) GB_DISPATCH(table, n + 0xb) \
+    GB_DISPATCH(table, n + 0xc) GB_DISPATCH(table, n + 0xd) GB_DISPATCH(table, n + 0xe) GB_DISPATCH(table, n + 0xf)
+#define GB_DISPATCH_256(table) \
+    GB_DISPATCH_16(table, 0x00) GB_DISPATCH_16(table, 0x10) GB_DISPATCH_16(table, 0x20) GB_DISPATCH_16(table, 0x30) \
+    GB_DISPATCH_16(table, 0x40) GB_DISPATCH_16(table, 0x50) GB_DISPATCH_16(table, 0x60) GB_DISPATCH_16(table, 0x70) \
+    GB_DISPATCH_16(table, 0x80) GB_DISPATCH_16(table, 0x90) GB_DISPATCH_16(table, 0xa0) GB_DISPATCH_16(table, 0xb0) \
+    GB_DISPATCH_16(table, 0xc0) GB_DISPATCH_16(table, 0xd0) GB_DISPATCH_16(table, 0xe0) GB_DISPATCH_16(table, 0xf0)
+
+namespace gb::cpu {
+    // Executes an already fetched opcode; regs.pc must point past it
+    inline Cycles Dispatch(const uint8_t op, Registers& regs, Memory& mem)
+    {
+        switch(op) {
+            GB_DISPATCH_256(opcode)
+        }
+        return 0;
+    }
+
+    // Likewise for the second byte of an instruction prefixed with CB
+    inline Cycles DispatchCB(const uint8_t op, Registers& regs, Memory& mem)
+    {
+        switch(op) {
+            GB_DISPATCH_256(opcode_cb)
+        }
+        return 0;
+    }
+
+    // Like Dispatch(), for an instruction with an immediate operand which
+    // was read in advance, as the block cache does; regs.pc must point
+    // past the opcode. The common forms take the operand as is, the others
+    // read it again. Must match the opcode[] handlers exactly
+    inline Cycles DispatchImmediate(const uint8_t op, const uint16_t operand, Registers& regs, Memory& mem)
+    {
+        const auto v = static_cast<uint8_t>(operand);
+        switch(op) {
+            // ld r,d8
+            case 0x06: regs.pc += 1; regs.b = v; return 8;
+            case 0x0e: regs.pc += 1; regs.c = v; return 8;
+            case 0x16: regs.pc += 1; regs.d = v; return 8;
+            case 0x1e: regs.pc += 1; regs.e = v; return 8;
+            case 0x26: regs.pc += 1; regs.h = v; return 8;
+            case 0x2e: regs.pc += 1; regs.l = v; return 8;
+            case 0x3e: regs.pc += 1; regs.a = v; return 8;
+            case 0x36: regs.pc += 1; mem.Write_u8(detail::FuseRegisters(regs.h, regs.l), v); return 12;
+            // ld rr,d16
+            case 0x01: regs.pc += 2; detail::DivideRegisters(operand, regs.b, regs.c); return 12;
+            case 0x11: regs.pc += 2; detail::DivideRegisters(operand, regs.d, regs.e); return 12;
+            case 0x21: regs.pc += 2; detail::DivideRegisters(operand, regs.h, regs.l); return 12;
+            case 0x31: regs.pc += 2; regs.sp = operand; return 12;
+            // jr, jp, call
+            case 0x18: regs.pc += 1; return detail::RelativeJump(regs, v, true);
+            case 0x20: regs.pc += 1; return detail::RelativeJump(regs, v, flag::IsClear(regs, Flag::z));
+            case 0x28: regs.pc += 1; return detail::RelativeJump(regs, v, flag::IsSet(regs, Flag::z));
+            case 0x30: regs.pc += 1; return detail::RelativeJump(regs, v, flag::IsClear(regs, Flag::c));
+            case 0x38: regs.pc += 1; return detail::RelativeJump(regs, v, flag::IsSet(regs, Flag::c));
+            case 0xc3: regs.pc += 2; return detail::AbsoluteJump(regs, operand, true);
+            case 0xc2: regs.pc += 2; return detail::AbsoluteJump(regs, operand, flag::IsClear(regs, Flag::z));
+            case 0xca: regs.pc += 2; return detail::AbsoluteJump(regs, operand, flag::IsSet(regs, Flag::z));
+            case 0xd2: regs.pc += 2; return detail::AbsoluteJump(regs, operand, flag::IsClear(regs, Flag::c));
+            case 0xda: regs.pc += 2; return detail::AbsoluteJump(regs, operand, flag::IsSet(regs, Flag::c));
+            case 0xcd: regs.pc += 2; return detail::AbsoluteCall(regs, mem, operand, true);
+            case 0xc4: regs.pc += 2; return detail::AbsoluteCall(regs, mem, operand, flag::IsClear(regs, Flag::z));
+            case 0xcc: regs.pc += 2; return detail::AbsoluteCall(regs, mem, operand, flag::IsSet(regs, Flag::z));
+            case 0xd4: regs.pc += 2; return detail::AbsoluteCall(regs, mem, operand, flag::IsClear(regs, Flag::c));
+            case 0xdc: regs.pc += 2; return detail::AbsoluteCall(regs, mem, operand, flag::IsSet(regs, Flag::c));
+            // ALU with an immediate
+            case 0xc6: regs.pc += 1; detail::Add_r8(regs, regs.a, v); return 8;
+            case 0xce: regs.pc += 1; detail::Adc_r8(regs, regs.a, v); return 8;
+            case 0xd6: regs.pc += 1; detail::Sub_r8(regs, regs.a, v); return 8;
+            case 0xde: regs.pc += 1; detail::Sbc_r8(regs, regs.a, v); return 8;
+            case 0xe6: regs.pc += 1; detail::And_A_r8(regs, v); return 8;
+            case 0xee: regs.pc += 1; detail::Xor_A_r8(regs, v); return 8;
+            case 0xf6: regs.pc += 1; detail::Or_A_r8(regs, v); return 8;
+            case 0xfe: regs.pc += 1; detail::Cp_A_r8(regs, v); return 8;
+            // ldh and absolute loads and stores of a
+            case 0xe0: regs.pc += 1; mem.Write_u8(0xff00 + v, regs.a); return 12;
+            case 0xf0: regs.pc += 1; regs.a = mem.Read_u8(0xff00 + v); return 12;
+            case 0xea: regs.pc += 2; mem.Write_u8(operand, regs.a); return 16;
+            case 0xfa: regs.pc += 2; regs.a = mem.Read_u8(operand); return 16;
+        }
+        return Dispatch(op, regs, mem);
+    }
+
+    // Fetches and executes the instruction at regs.pc; the same as calling
+    // the opcode[] or opcode_cb[] entry, minus the indirect call
+    inline Cycles Execute(Registers& regs, Memory& mem)
+    {
+        const auto op = detail::ReadAndAdvancePC_u8(regs, mem);
+        if (op == 0xcb)
+            return DispatchCB(detail::ReadAndAdvancePC_u8(regs, mem), regs, mem);
+        return Dispatch(op, regs, mem);
+    }
+}
+
+#undef GB_DISPATCH_256
+#undef GB_DISPATCH_16
+#undef GB_DISPATCH
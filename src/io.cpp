@@ -1,9 +1,16 @@
 #include "io.h"
 #include "memory.h"
 #include "audio.h"
+#include "profiler.h"
+#include "state.h"
 #include "video.h"
 
 namespace gb {
+    namespace {
+        // Clock cycles per TIMA increment, indexed by the lower bits of TAC
+        constexpr std::array<Cycle, 4> timerPeriod{ 1024, 16, 64, 256 };
+    }
+
     uint8_t& IO::Register(const Address address)
     {
         const auto index = address - memory_map::IOStart;
@@ -34,6 +41,15 @@ namespace gb {
             }
             case io::IE:
                 return ie;
+            case io::DIV:
+                return static_cast<uint8_t>((scheduler.now - dividerStart) >> 8);
+            case io::TIMA:
+                SyncTimer();
+                break;
+            case io::SB:
+            case io::SC:
+                SyncSerial();
+                break;
         }
         if (address >= io::LCDC && address <= io::WX)
             return video.Read(address);
@@ -59,9 +75,47 @@ namespace gb {
             case io::IE:
                 ie = value;
                 break;
-            case io::DIV:
-                Register(address) = 0;
+            case io::DIV: {
+                // Resetting the divider counts as TIMA reaching the next
+                // period if it is halfway there
+                SyncTimer();
+                const auto tac = Register(io::TAC);
+                const auto period = timerPeriod[tac & 3];
+                const bool increment = (tac & 4) != 0 && ((scheduler.now - dividerStart) & (period / 2)) != 0;
+                dividerStart = scheduler.now;
+                if (increment && ++Register(io::TIMA) == 0) {
+                    Register(io::TIMA) = Register(io::TMA);
+                    Register(io::IF) |= interrupt::Timer;
+                }
+                SyncTimer();
                 break;
+            }
+            case io::TIMA:
+            case io::TMA:
+            case io::TAC:
+                SyncTimer();
+                Register(address) = value;
+                SyncTimer();
+                break;
+            case io::SC: {
+                SyncSerial();
+                Register(address) = value;
+                if ((value & 0x80) == 0) {
+                    scheduler.Cancel(event::Serial);
+                    break;
+                }
+                const auto byte = Register(io::SB);
+                serialOutput.push_back(static_cast<char>(byte));
+                if (onSerialByte)
+                    onSerialByte(byte);
+                // An external clock never comes, so neither does the end
+                // of such a transfer
+                if ((value & 1) != 0)
+                    scheduler.Schedule(event::Serial, scheduler.now + SerialCycles);
+                else
+                    scheduler.Cancel(event::Serial);
+                break;
+            }
             default:
                 Register(address) = value;
                 break;
@@ -71,10 +125,10 @@ namespace gb {
     std::optional<int> IO::GetPendingIRQ()
     {
         const auto interruptScheduled = Register(io::IF);
-        const auto pendingInterrupts = interruptScheduled & ie;
+        const auto pendingInterrupts = interruptScheduled & ie & 0x1f;
         if (pendingInterrupts == 0) return {};
 
-        for (int n = 0; n < 8; ++n) {
+        for (int n = 0; n < 5; ++n) {
             if ((pendingInterrupts & (1 << n)) == 0) continue;
             return n;
         }
@@ -92,44 +146,61 @@ namespace gb {
         return Register(io::DMG) == 0;
     }
 
-    void IO::Tick(const int cycles)
+    void IO::SyncTimer()
     {
-        divCount += cycles;
-        if (divCount >= 256) {
-            ++Register(io::DIV);
-            divCount = 0;
+        ScopedTimer timer(profiler, subsystem::IO);
+        const auto now = scheduler.now;
+        const auto tac = Register(io::TAC);
+        if ((tac & 4) == 0) {
+            timerSync = now;
+            scheduler.Cancel(event::Timer);
+            return;
         }
 
-        lcdCount += cycles;
-        if (lcdCount >= 10) {
-            auto& ly = Register(io::LY);
-            if (++ly == 154) {
-                ly = 0;
-            }
+        // TIMA counts every time the divider passes a multiple of the
+        // period; after overflowing, it restarts at TMA
+        const auto period = timerPeriod[tac & 3];
+        const auto increments = (now - dividerStart) / period - (timerSync - dividerStart) / period;
+        timerSync = now;
+        auto& tima = Register(io::TIMA);
+        if (const auto value = tima + increments; value > 0xff) {
+            const auto tma = Register(io::TMA);
+            tima = tma + (value - 0x100) % (0x100 - tma);
+            Register(io::IF) |= interrupt::Timer;
+        } else {
+            tima = static_cast<uint8_t>(value);
         }
 
-        const auto tac = Register(io::TAC);
-        if ((tac & 1) == 0) return;
-        const auto timaInterval = [tac]() {
-            switch(tac&3) {
-                case 0: return 1024;
-                case 1: return 16;
-                case 2: return 64;
-                case 3: return 256;
-            }
-            return 0;
-        }();
-
-        timaCount += cycles;
-        if (timaCount >= timaInterval) {
-            auto& tima = Register(io::TIMA);
-            if (tima == 255) {
-                tima = Register(io::TMA);
-                Register(io::IF) |= interrupt::Timer;
-            } else {
-                ++tima;
-            }
-            timaCount = 0;
-        }
+        const auto overflow = (now - dividerStart) / period + (0x100 - tima);
+        scheduler.Schedule(event::Timer, dividerStart + overflow * period);
+    }
+
+    void IO::SyncSerial()
+    {
+        if (!scheduler.IsDue(event::Serial)) return;
+        scheduler.Cancel(event::Serial);
+        Register(io::SB) = 0xff;
+        Register(io::SC) &= 0x7f;
+        Register(io::IF) |= interrupt::Serial;
+    }
+
+    void IO::SaveState(state::Writer& writer) const
+    {
+        writer.Write(data);
+        writer.Write(dividerStart);
+        writer.Write(timerSync);
+        writer.Write(buttonPressed);
+        writer.Write(ie);
+        writer.Write(serialOutput);
+    }
+
+    void IO::LoadState(state::Reader& reader)
+    {
+        reader.Read(data);
+        reader.Read(dividerStart);
+        reader.Read(timerSync);
+        reader.Read(buttonPressed);
+        reader.Read(ie);
+        reader.Read(serialOutput);
     }
 }
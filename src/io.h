@@ -1,14 +1,19 @@
 #pragma once
 
+#include "scheduler.h"
 #include "types.h"
 #include <array>
+#include <functional>
 #include <optional>
+#include <string>
 
 namespace gb {
     namespace cpu { struct Registers; }
     struct Memory;
     class Video;
     class Audio;
+    struct Profiler;
+    namespace state { class Reader; class Writer; }
 
     namespace button {
         inline constexpr uint8_t A = (1 << 0);
@@ -22,23 +27,44 @@ namespace gb {
     }
 
     struct IO {
-        IO(Video& video, Audio& audio) : video(video), audio(audio) { }
+        IO(Scheduler& scheduler, Video& video, Audio& audio) : scheduler(scheduler), video(video), audio(audio) { }
 
         uint8_t Read(Address address);
         void Write(Address address, uint8_t value);
         std::optional<int> GetPendingIRQ();
+        bool IsIRQPending() const { return (data[io::IF - memory_map::IOStart] & ie & 0x1f) != 0; }
         void ClearPendingIRQ(int n);
-        void Tick(const int cycles);
         bool IsBootstrapROMEnabled();
+        // Brings DIV and TIMA up to the current clock cycle and schedules
+        // the next TIMA overflow. This happens when the event::Timer
+        // deadline passes and before any timer register access
+        void SyncTimer();
+        // Completes a serial transfer once it has taken SerialCycles. With
+        // no other Game Boy attached, 0xff is shifted in. This happens
+        // when the event::Serial deadline passes and before SB/SC are read
+        void SyncSerial();
+        // 8 bits at 8192 Hz, when the Game Boy provides the clock
+        static constexpr Cycle SerialCycles = 8 * 512;
 
         uint8_t& Register(const Address address);
 
+        void SaveState(state::Writer& writer) const;
+        void LoadState(state::Reader& reader);
+
+        Scheduler& scheduler;
         Video& video;
         Audio& audio;
+        Profiler* profiler{};
         std::array<uint8_t, 128> data{};
-        int timaCount{}, divCount{}, lcdCount{};
+        // The divider counts every clock cycle since dividerStart; TIMA
+        // is up to date as of timerSync
+        Cycle dividerStart{}, timerSync{};
 
         uint8_t buttonPressed{};
         uint8_t ie{};
+        // Every byte whose transfer was started through SC; onSerialByte,
+        // if set, is called with each as well
+        std::string serialOutput;
+        std::function<void(uint8_t)> onSerialByte;
     };
 }
@@ -0,0 +1,176 @@
+#include "job.h"
+#include "system.h"
+
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+
+namespace gb::job {
+
+namespace {
+    constexpr uint32_t requestMagic = 0x4a424752; // "RGBJ"
+    constexpr uint32_t resultMagic = 0x52424752; // "RGBR"
+
+    void WriteBytes(state::Writer& writer, const std::vector<uint8_t>& bytes)
+    {
+        writer.Write(static_cast<uint32_t>(bytes.size()));
+        writer.WriteBytes(bytes.data(), bytes.size());
+    }
+
+    // Counts are checked against the size of the data before anything
+    // is allocated for them
+    uint32_t ReadCount(state::Reader& reader, const std::vector<uint8_t>& data, const size_t entrySize)
+    {
+        const auto count = reader.Read<uint32_t>();
+        if (count > data.size() / entrySize)
+            throw std::runtime_error("job truncated");
+        return count;
+    }
+
+    std::vector<uint8_t> ReadBytes(state::Reader& reader, const std::vector<uint8_t>& data)
+    {
+        std::vector<uint8_t> bytes(ReadCount(reader, data, 1));
+        reader.ReadBytes(bytes.data(), bytes.size());
+        return bytes;
+    }
+
+    void CheckMagic(state::Reader& reader, const std::vector<uint8_t>& data, const uint32_t magic)
+    {
+        if (data.size() < sizeof(magic) || reader.Read<uint32_t>() != magic)
+            throw std::runtime_error("not a job");
+    }
+}
+
+Result Run(const Request& request, std::shared_ptr<const ROM> rom)
+{
+    Result result;
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        System system(std::move(rom));
+        std::optional<Movie> movie;
+        if (!request.movie.empty()) {
+            movie = Movie::Decode(request.movie);
+            if (movie->romHash != system.cartridge.GetROM().GetHash())
+                throw std::runtime_error("movie belongs to a different cartridge");
+            if (!request.state.empty())
+                throw std::runtime_error("movies start from reset, not from a state");
+        }
+        const uint32_t frames = request.frames != 0 ? request.frames : (movie ? movie->length : 0);
+        if (frames == 0)
+            throw std::runtime_error("expected a frame limit");
+
+        if (!request.state.empty())
+            system.LoadState(request.state);
+        else
+            system.Reset(movie ? movie->bootROM : request.bootROM);
+
+        std::optional<MoviePlayer> player;
+        if (movie)
+            player.emplace(*movie);
+        size_t nextHash = 0;
+        const auto startFrame = [&]() {
+            const auto& frameBuffer = system.video.GetFrameBuffer();
+            for (; nextHash < request.hashFrames.size() && request.hashFrames[nextHash] <= result.frames; ++nextHash) {
+                if (request.hashFrames[nextHash] == result.frames)
+                    result.hashes.push_back({ result.frames, HashFrameBuffer(frameBuffer) });
+            }
+            if (player)
+                system.io.buttonPressed = player->StartFrame(result.frames, frameBuffer);
+        };
+
+        startFrame();
+        while (result.frames < frames && (!player || player->GetMismatch().empty())) {
+            result.cycles += system.Run(System::CyclesPerFrame);
+            if (system.video.GetRenderFlagAndReset()) {
+                ++result.frames;
+                startFrame();
+            }
+        }
+
+        result.serialOutput = system.io.serialOutput;
+        if (player) {
+            result.matchedCheckpoints = static_cast<uint32_t>(player->GetNumberOfMatchedCheckpoints());
+            result.error = player->GetMismatch();
+        }
+    } catch (std::exception& e) {
+        result.error = e.what();
+    }
+    result.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+std::vector<uint8_t> Encode(const Request& request)
+{
+    std::vector<uint8_t> data;
+    state::Writer writer(data);
+    writer.Write(requestMagic);
+    writer.Write(request.romHash);
+    writer.Write(request.bootROM);
+    writer.Write(request.frames);
+    WriteBytes(writer, request.movie);
+    WriteBytes(writer, request.state);
+    writer.Write(static_cast<uint32_t>(request.hashFrames.size()));
+    for (const auto frame: request.hashFrames)
+        writer.Write(frame);
+    return data;
+}
+
+std::vector<uint8_t> Encode(const Result& result)
+{
+    std::vector<uint8_t> data;
+    state::Writer writer(data);
+    writer.Write(resultMagic);
+    writer.Write(result.error);
+    writer.Write(result.frames);
+    writer.Write(result.cycles);
+    writer.Write(result.nanoseconds);
+    writer.Write(result.matchedCheckpoints);
+    writer.Write(static_cast<uint32_t>(result.hashes.size()));
+    for (const auto& hash: result.hashes) {
+        writer.Write(hash.frame);
+        writer.Write(hash.hash);
+    }
+    writer.Write(result.serialOutput);
+    return data;
+}
+
+Request DecodeRequest(const std::vector<uint8_t>& data)
+{
+    state::Reader reader(data);
+    CheckMagic(reader, data, requestMagic);
+    Request request;
+    reader.Read(request.romHash);
+    request.bootROM = reader.Read<uint8_t>() != 0;
+    reader.Read(request.frames);
+    request.movie = ReadBytes(reader, data);
+    request.state = ReadBytes(reader, data);
+    request.hashFrames.resize(ReadCount(reader, data, sizeof(uint32_t)));
+    for (auto& frame: request.hashFrames)
+        reader.Read(frame);
+    if (!reader.AtEnd())
+        throw std::runtime_error("unexpected data after job");
+    return request;
+}
+
+Result DecodeResult(const std::vector<uint8_t>& data)
+{
+    state::Reader reader(data);
+    CheckMagic(reader, data, resultMagic);
+    Result result;
+    reader.Read(result.error);
+    reader.Read(result.frames);
+    reader.Read(result.cycles);
+    reader.Read(result.nanoseconds);
+    reader.Read(result.matchedCheckpoints);
+    result.hashes.resize(ReadCount(reader, data, sizeof(uint32_t) + sizeof(uint64_t)));
+    for (auto& hash: result.hashes) {
+        reader.Read(hash.frame);
+        reader.Read(hash.hash);
+    }
+    reader.Read(result.serialOutput);
+    if (!reader.AtEnd())
+        throw std::runtime_error("unexpected data after result");
+    return result;
+}
+
+}
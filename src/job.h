@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "movie.h"
+#include "rom.h"
+
+namespace gb::job {
+
+// One regression run, as sent to gbemu-worker: a machine running the ROM
+// with the given hash, started from reset (or from a state) and fed the
+// input of a movie, for a number of frames
+struct Request {
+    uint64_t romHash{};
+    // Ignored when starting from a movie, which knows, or a state
+    bool bootROM{};
+    // 0: the length of the movie
+    uint32_t frames{};
+    // Movie::Encode(), whose checkpoints are checked; may be empty
+    std::vector<uint8_t> movie;
+    // System::SaveState(), instead of resetting; may be empty
+    std::vector<uint8_t> state;
+    // The framebuffer is hashed at the start of these frames, in
+    // ascending order
+    std::vector<uint32_t> hashFrames;
+};
+
+struct Result {
+    // Empty if the run completed and all checkpoints of the movie matched
+    std::string error;
+    uint32_t frames{};
+    uint64_t cycles{};
+    // Host time spent emulating
+    uint64_t nanoseconds{};
+    uint32_t matchedCheckpoints{};
+    std::vector<Movie::Checkpoint> hashes;
+    std::string serialOutput;
+};
+
+// Runs the request on a machine of its own; failures are reported in
+// Result::error rather than thrown
+Result Run(const Request& request, std::shared_ptr<const ROM> rom);
+
+// Compact binary encodings, in the host byte order like the state files.
+// Decoding throws std::runtime_error on malformed data
+std::vector<uint8_t> Encode(const Request& request);
+std::vector<uint8_t> Encode(const Result& result);
+Request DecodeRequest(const std::vector<uint8_t>& data);
+Result DecodeResult(const std::vector<uint8_t>& data);
+
+}
@@ -1,104 +1,117 @@
-#include "cpu.h"
-#include "memory.h"
 #include "gui.h"
-#include "io.h"
-#include "video.h"
-#include "audio.h"
+#include "audio_scope.h"
 #include "cartridge.h"
+#include "frame_capture.h"
+#include "frame_pacer.h"
+#include "movie.h"
+#include "rewind.h"
+#include "sfml_audio_sink.h"
+#include "system.h"
+#include "wav_writer.h"
 
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <thread>
 #include <unistd.h>
-#include <chrono>
 
 #include "fmt/core.h"
 
-using IO = gb::IO;
-using Memory = gb::Memory;
-using Registers = gb::cpu::Registers;
-using Video = gb::Video;
-using Audio = gb::Audio;
-
 namespace {
 
-bool optionTraceCPU = false;
+std::string optionTracePath;
 bool optionTraceMemory = false;
 bool optionTraceCartridge = false;
+bool optionTraceAudio = false;
 bool optionBootROM = false;
-
-std::string RegistersToString(const Registers& regs)
-{
-    return fmt::format("{:04x} [a {:02x} b/c {:02x}{:02x} d/e {:02x}{:02x} h/l {:02x}{:02x} flags {}{}{}{}{}{} sp {:04x}]",
-        regs.pc,
-        regs.a, regs.b, regs.c, regs.d, regs.e, regs.h, regs.l,
-        gb::cpu::flag::IsSet(regs, gb::cpu::Flag::z) ? 'Z' : '-',
-        gb::cpu::flag::IsSet(regs, gb::cpu::Flag::n) ? 'N' : '-',
-        gb::cpu::flag::IsSet(regs, gb::cpu::Flag::h) ? 'H' : '-',
-        gb::cpu::flag::IsSet(regs, gb::cpu::Flag::c) ? 'C' : '-',
-        regs.ime ? 'I' : '-',
-        regs.halt ? 'h' : '-',
-        regs.sp);
-}
-
-std::string Disassemble(const Registers& regs, const Memory& memory, const IO& io, const gb::cpu::Instruction& instruction, const bool has_prefix)
-{
-    using Argument = gb::cpu::Argument;
-
-    std::string arg{"???"};
-    int num_bytes = has_prefix ? 2 : 1;
-    switch(instruction.arg) {
-        case Argument::None:
-            arg = "";
-            break;
-        case Argument::Imm8:
-            arg = fmt::format("{:02x}", memory.At_u8(regs.pc));
-            num_bytes += 1;
-            break;
-        case Argument::Imm16:
-            arg = fmt::format("{:02x}{:02x}", memory.At_u8(regs.pc + 1), memory.At_u8(regs.pc));
-            num_bytes += 2;
-            break;
-        case Argument::Rel8: {
-            const uint16_t new_pc = regs.pc + 1 + static_cast<int8_t>(memory.At_u8(regs.pc));
-            arg = fmt::format("{:x}", new_pc);
-            num_bytes += 1;
-            break;
-        }
-    }
-
-    std::string bytes;
-    auto pc_start = regs.pc - (has_prefix ? 2 : 1);
-    for(int n = 0; n < num_bytes; ++n) {
-        bytes += fmt::format("{:02x}", memory.At_u8(pc_start + n));
-    }
-
-    return fmt::format("{:8s} {}", bytes, fmt::format(instruction.name, arg));
-}
+bool optionMute = false;
+std::string optionWavPath;
+std::string optionVideoPath;
+long optionRewindSeconds = 60;
+std::string optionMoviePath;
+bool optionTurbo = false;
+int optionFrameSkip = 1;
+std::string optionSaveFilePath;
+bool optionNoSaveFile = false;
+std::string optionProfilePath;
+bool optionProfile = false;
+std::shared_ptr<const gb::ROM> rom;
 
 bool ProcessOptions(int argc, char* argv[])
 {
     int opt;
-    while ((opt = getopt(argc, argv, "h?tmcb")) != -1) {
+    while ((opt = getopt(argc, argv, "h?t:mcabqw:v:r:M:Tk:s:SP:")) != -1) {
         switch(opt) {
             case 'h':
             case '?':
-                std::cout << fmt::format("usage: {} [-h?tmcb] cartridge.gb\n\n", argv[0]);
+                std::cout << fmt::format("usage: {} [-h?mcabqTS] [-t file.trace] [-w audio.wav] [-v video.y4m] [-r seconds] [-M movie.gbm] [-k frames] [-s file.sav] [-P file.folded] cartridge.gb\n\n", argv[0]);
                 std::cout << fmt::format("  -h, -?     this help\n");
-                std::cout << fmt::format("  -t         trace CPU instructions\n");
-                std::cout << fmt::format("  -m         trace memory access\n");
+                std::cout << fmt::format("  -t file    trace CPU instructions, saving the last ones to file on exit\n");
+                std::cout << fmt::format("  -m         trace memory access as well (needs -t)\n");
                 std::cout << fmt::format("  -c         trace cartridge access\n");
+                std::cout << fmt::format("  -a         trace audio register access\n");
                 std::cout << fmt::format("  -b         enable bootrom emulation\n");
+                std::cout << fmt::format("  -q         do not play audio\n");
+                std::cout << fmt::format("  -w file    write audio to file (WAV) instead of playing it\n");
+                std::cout << fmt::format("  -v file    write every frame to file (Y4M); \"|command\" pipes them to\n");
+                std::cout << fmt::format("             the command instead, e.g. \"|ffmpeg -i - run.mp4\"\n");
+                std::cout << fmt::format("  -r seconds length of the rewind history, 0 to disable (default: {})\n", optionRewindSeconds);
+                std::cout << fmt::format("  -M file    record the input to file (movie), for replaying headless;\n");
+                std::cout << fmt::format("             this disables rewinding\n");
+                std::cout << fmt::format("  -T         start in turbo mode (unthrottled); holding space also enables it\n");
+                std::cout << fmt::format("  -k frames  only show every nth frame (default: {})\n", optionFrameSkip);
+                std::cout << fmt::format("  -s file    keep battery-backed RAM in file (default: <cartridge>.sav)\n");
+                std::cout << fmt::format("  -S         do not keep battery-backed RAM; recording a movie implies this\n");
+                std::cout << fmt::format("  -P file    profile execution from the start, exporting it to file as\n");
+                std::cout << fmt::format("             collapsed stacks on exit (default file: <cartridge>.folded)\n");
                 return false;
             case 't':
-                optionTraceCPU = true;
+                optionTracePath = optarg;
+                break;
             case 'm':
                 optionTraceMemory = true;
                 break;
             case 'c':
                 optionTraceCartridge = true;
                 break;
+            case 'a':
+                optionTraceAudio = true;
+                break;
             case 'b':
                 optionBootROM = true;
                 break;
+            case 'q':
+                optionMute = true;
+                break;
+            case 'w':
+                optionWavPath = optarg;
+                break;
+            case 'v':
+                optionVideoPath = optarg;
+                break;
+            case 'r':
+                optionRewindSeconds = std::stol(optarg);
+                break;
+            case 'M':
+                optionMoviePath = optarg;
+                break;
+            case 'T':
+                optionTurbo = true;
+                break;
+            case 'k':
+                optionFrameSkip = std::stoi(optarg);
+                break;
+            case 's':
+                optionSaveFilePath = optarg;
+                break;
+            case 'S':
+                optionNoSaveFile = true;
+                break;
+            case 'P':
+                optionProfilePath = optarg;
+                optionProfile = true;
+                break;
         }
     }
 
@@ -106,10 +119,17 @@ bool ProcessOptions(int argc, char* argv[])
         std::cout << fmt::format("expected cartridge.gb file after options\n");
         return false;
     }
+    if (optionTraceMemory && optionTracePath.empty()) {
+        std::cout << fmt::format("-m needs a trace file (-t)\n");
+        return false;
+    }
 
+    if (optionSaveFilePath.empty())
+        optionSaveFilePath = std::filesystem::path(argv[optind]).replace_extension(".sav").string();
+    if (optionProfilePath.empty())
+        optionProfilePath = std::filesystem::path(argv[optind]).replace_extension(".folded").string();
     try {
-        gb::cartridge::Load(argv[optind]);
-        gb::cartridge::SetTracing(optionTraceCartridge);
+        rom = gb::LoadROM(argv[optind]);
     } catch (std::exception& e) {
         std::cout << fmt::format("cannot load '{}': {}\n", argv[optind], e.what());
         return false;
@@ -117,82 +137,228 @@ bool ProcessOptions(int argc, char* argv[])
     return true;
 }
 
-}
-
-int main(int argc, char* argv[])
+// Runs the machine until the UI quits, at the start of a frame; the UI is
+// only ever talked to through controls
+void RunEmulation(gb::System& system, gb::gui::Controls& controls, gb::Rewind* rewind, gb::Movie* movie, gb::ExecutionProfile& profile, gb::FrameCapture* capture, const gb::AudioScope& scope)
 {
-    if (!ProcessOptions(argc, argv)) return 1;
+    // Checkpoints are taken once a second, at 60 frames per second
+    constexpr uint32_t MovieCheckpointInterval = 60;
+    // In case the game keeps the RAM enabled
+    constexpr uint32_t SaveFileFlushInterval = 60;
+    constexpr uint32_t ProfileReportInterval = 30;
+    constexpr size_t ProfileHotSpots = 64;
+    uint32_t frames = 0;
+    bool profiling = false;
+    std::string profileStatus;
 
-    Video video;
-    Audio audio;
-    IO io(video, audio);
-    Memory memory(io);
-    memory.enableTracing = optionTraceMemory;
-    Registers regs;
-
-    if (!optionBootROM) {
-        // From https://gbdev.gg8.se/wiki/articles/Power_Up_Sequence
-        regs.a = 0x01; regs.fl = 0xb0;
-        regs.b = 0x00; regs.c = 0x13;
-        regs.d = 0x00; regs.e = 0xd8;
-        regs.h = 0x01; regs.l = 0x4d;
-        regs.pc = 0x100;
-    } else {
-        regs.pc = 0x0;
-    }
-    regs.sp = 0xfffe;
-
-    gb::gui::Init();
-    auto current = std::chrono::steady_clock::now();
-    while(true) {
-        const auto* instruction = &gb::cpu::opcode[0x00]; // NOP
-        if (regs.stop) {
-            printf("in stop\n");
-            if (io.buttonPressed != 0)
-                regs.stop = false;
-        } else if (!regs.halt) {
-            const auto orig_regs = regs;
-            const auto opcode = gb::cpu::detail::ReadAndAdvancePC_u8(regs, memory);
-
-            if (opcode != 0xcb) {
-                instruction = &gb::cpu::opcode[opcode];
-            } else {
-                const auto opcode2 = gb::cpu::detail::ReadAndAdvancePC_u8(regs, memory);
-                instruction = &gb::cpu::opcode_cb[opcode2];
+    const auto updateProfile = [&]() {
+        if (controls.profiling != profiling) {
+            profiling = controls.profiling;
+            system.SetExecutionProfile(profiling ? &profile : nullptr);
+        }
+        bool changed = false;
+        if (controls.clearProfile.exchange(false)) {
+            profile.Clear();
+            changed = true;
+        }
+        if (controls.exportProfile.exchange(false)) {
+            try {
+                profile.SaveCollapsedStacks(optionProfilePath);
+                profileStatus = fmt::format("exported to {}", optionProfilePath);
+            } catch (std::exception& e) {
+                profileStatus = fmt::format("cannot export to {}: {}", optionProfilePath, e.what());
             }
+            changed = true;
+        }
+        if (!changed && (!profiling || frames % ProfileReportInterval != 0))
+            return;
+        auto& report = controls.profile.GetBack();
+        const auto sortBy = controls.profileSortBy.load();
+        report.hotSpots = profile.GetHotSpots(ProfileHotSpots, sortBy);
+        report.opcodes = profile.GetOpcodes(sortBy);
+        report.cycles = 0;
+        for (const auto& opcode: report.opcodes)
+            report.cycles += opcode.counter.cycles;
+        report.status = profileStatus;
+        controls.profile.Publish();
+    };
+
+    const auto publishFrame = [&]() {
+        controls.frames.GetBack() = system.video.GetFrameBuffer();
+        controls.frames.Publish();
+        controls.scope.GetBack() = scope.GetSnapshot();
+        controls.scope.Publish();
+    };
 
-            if (optionTraceCPU) {
-                const auto disasm = Disassemble(regs, memory, io, *instruction, opcode == 0xcb);
-                std::cout << fmt::format("{} {}", RegistersToString(orig_regs), disasm) << "\n";
+    gb::FramePacer pacer;
+    while(true) {
+        if (controls.paused) {
+            if (controls.quit)
+                break;
+            updateProfile();
+            // Frames may have been dropped since the UI picked this one
+            if (const int n = controls.restoreFrame.exchange(-1); rewind && n >= 0 && static_cast<size_t>(n) < rewind->GetNumberOfFrames()) {
+                rewind->Restore(n);
+                publishFrame();
             }
+            std::this_thread::sleep_for(std::chrono::duration<double>(1.0 / gb::FramePacer::FrameRate));
+            continue;
         }
 
-        const int numClocks = instruction->func(regs, memory);
-        io.Tick(numClocks);
-        video.Tick(io, memory, numClocks);
-        audio.Tick(io, memory, numClocks);
+        system.Run(gb::System::CyclesPerFrame);
+        if (!system.video.GetRenderFlagAndReset())
+            continue;
+        if (capture)
+            capture->OnFrame();
 
-        if (video.GetRenderFlagAndReset()) {
-            gb::gui::UpdateTexture(video.GetFrameBuffer());
-            gb::gui::Render();
-            if (!gb::gui::HandleEvents(io))
-                break;
+        pacer.SetMode(controls.turbo ? gb::FramePacer::Mode::Turbo : gb::FramePacer::Mode::RealTime);
+        pacer.SetFrameSkip(controls.frameSkip);
+        if (pacer.NextFrame())
+            publishFrame();
+        controls.frameRate = pacer.GetFrameRate();
+        if (++frames % SaveFileFlushInterval == 0)
+            system.cartridge.FlushSaveFile();
+        updateProfile();
+        if (movie && ++movie->length % MovieCheckpointInterval == 0)
+            movie->checkpoints.push_back({ movie->length, gb::HashFrameBuffer(system.video.GetFrameBuffer()) });
+        if (controls.quit)
+            break;
+
+        system.io.buttonPressed = controls.buttons;
+        if (movie)
+            movie->RecordInput(movie->length, system.io.buttonPressed);
+        if (rewind) {
+            rewind->Record();
+            controls.rewindFrames = static_cast<int>(rewind->GetNumberOfFrames());
+            controls.rewindMemoryUsage = rewind->GetMemoryUsage();
         }
+        pacer.Wait();
+    }
+}
 
-        auto now = std::chrono::steady_clock::now();
-        auto diff = std::chrono::duration<double, std::micro>(now - current);
-        //printf("%d clocks took %.2f us\n", numClocks, diff.count());
-        current = now;
+}
 
-        if (auto pendingIrq = io.GetPendingIRQ(); pendingIrq) {
-            regs.halt = false;
-            if (regs.ime) {
-                io.ClearPendingIRQ(*pendingIrq);
-                gb::cpu::InvokeIRQ(regs, memory, *pendingIrq);
-            }
+int main(int argc, char* argv[])
+{
+    if (!ProcessOptions(argc, argv)) return 1;
+
+    std::unique_ptr<gb::System> systemPtr;
+    try {
+        systemPtr = std::make_unique<gb::System>(rom);
+    } catch (std::exception& e) {
+        std::cout << fmt::format("cannot use cartridge: {}\n", e.what());
+        return 1;
+    }
+    // The scope in the Audio window sees everything the output gets
+    std::shared_ptr<gb::AudioScope> scope;
+    // Like the video, samples are dropped rather than holding up the emulation
+    std::shared_ptr<gb::WavWriter> wav;
+    try {
+        std::shared_ptr<gb::AudioSink> output;
+        if (!optionWavPath.empty())
+            output = wav = std::make_shared<gb::WavWriter>(optionWavPath, gb::WavWriter::Overflow::Drop);
+        else if (!optionMute)
+            output = std::make_shared<gb::SFMLAudioSink>();
+        scope = std::make_shared<gb::AudioScope>(std::move(output));
+        systemPtr->audio.SetSink(scope);
+    } catch (std::exception& e) {
+        std::cout << fmt::format("cannot open audio output: {}\n", e.what());
+        return 1;
+    }
+    auto& system = *systemPtr;
+    std::unique_ptr<gb::trace::Buffer> trace;
+    if (!optionTracePath.empty()) {
+        trace = std::make_unique<gb::trace::Buffer>();
+        system.SetTrace(trace.get(), optionTraceMemory);
+    }
+    system.cartridge.SetTracing(optionTraceCartridge);
+    system.audio.SetTracing(optionTraceAudio);
+    // A movie starts from reset, with the RAM empty
+    if (system.cartridge.HasBattery() && !optionNoSaveFile && optionMoviePath.empty()) {
+        try {
+            system.cartridge.AttachSaveFile(optionSaveFilePath);
+        } catch (std::exception& e) {
+            std::cout << fmt::format("cannot use save file: {}\n", e.what());
+            return 1;
+        }
+    }
+    system.Reset(optionBootROM);
+
+    // Frames are dropped rather than holding up the emulation
+    std::unique_ptr<gb::FrameCapture> capture;
+    if (!optionVideoPath.empty()) {
+        try {
+            capture = std::make_unique<gb::FrameCapture>(system.video, optionVideoPath, gb::FrameCapture::Overflow::Drop);
+        } catch (std::exception& e) {
+            std::cout << fmt::format("cannot capture video: {}\n", e.what());
+            return 1;
         }
     }
+
+    // Rewinding would make the recorded input meaningless
+    std::unique_ptr<gb::Rewind> rewind;
+    if (optionRewindSeconds > 0 && optionMoviePath.empty())
+        rewind = std::make_unique<gb::Rewind>(system, optionRewindSeconds * 60);
+
+    gb::Movie movie;
+    movie.romHash = rom->GetHash();
+    movie.bootROM = optionBootROM;
+
+    // The UI stays on the main thread, as some platforms require
+    gb::ExecutionProfile profile(system.memory);
+    auto controls = std::make_unique<gb::gui::Controls>();
+    controls->turbo = optionTurbo;
+    controls->frameSkip = optionFrameSkip;
+    controls->profiling = optionProfile;
+    gb::gui::Init(*controls);
+    std::thread emulation([&]() {
+        RunEmulation(system, *controls, rewind.get(), optionMoviePath.empty() ? nullptr : &movie, profile, capture.get(), *scope);
+    });
+    while(gb::gui::HandleEvents()) {
+        gb::gui::UpdateTexture();
+        gb::gui::Render();
+    }
+    controls->quit = true;
+    emulation.join();
     gb::gui::Cleanup();
 
+    if (capture) {
+        capture->Finish();
+        if (capture->HasWriteError())
+            std::cout << fmt::format("video capture failed: '{}' is incomplete\n", optionVideoPath);
+        if (capture->GetNumberOfDroppedFrames() > 0)
+            std::cout << fmt::format("video capture dropped {} of {} frames\n", capture->GetNumberOfDroppedFrames(), capture->GetNumberOfFrames() + capture->GetNumberOfDroppedFrames());
+        capture.reset();
+    }
+    if (wav && wav->GetNumberOfDroppedSamples() > 0)
+        std::cout << fmt::format("audio capture dropped {} samples\n", wav->GetNumberOfDroppedSamples());
+
+    if (!optionMoviePath.empty()) {
+        // The loop ends at the start of a frame, so this is a complete one
+        if (movie.checkpoints.empty() || movie.checkpoints.back().frame != movie.length)
+            movie.checkpoints.push_back({ movie.length, gb::HashFrameBuffer(system.video.GetFrameBuffer()) });
+        try {
+            movie.Save(optionMoviePath);
+        } catch (std::exception& e) {
+            std::cout << fmt::format("cannot save movie: {}\n", e.what());
+            return 1;
+        }
+    }
+    if (optionProfile) {
+        try {
+            profile.SaveCollapsedStacks(optionProfilePath);
+        } catch (std::exception& e) {
+            std::cout << fmt::format("cannot save profile: {}\n", e.what());
+            return 1;
+        }
+    }
+    if (trace) {
+        try {
+            trace->Save(optionTracePath);
+        } catch (std::exception& e) {
+            std::cout << fmt::format("{}\n", e.what());
+            return 1;
+        }
+    }
     return 0;
 }
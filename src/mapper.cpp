@@ -0,0 +1,266 @@
+#include "mapper.h"
+#include "state.h"
+#include <array>
+
+namespace gb {
+
+namespace {
+    using mapper::CartridgeType;
+    using mapper::Kind;
+
+    const std::array<std::pair<uint8_t, CartridgeType>, 19> cartridgeTypes{ {
+        { 0x00, { Kind::None } },
+        { 0x01, { Kind::MBC1 } },
+        { 0x02, { Kind::MBC1, true } },
+        { 0x03, { Kind::MBC1, true, true } },
+        { 0x05, { Kind::MBC2, true } },
+        { 0x06, { Kind::MBC2, true, true } },
+        { 0x08, { Kind::None, true } },
+        { 0x09, { Kind::None, true, true } },
+        { 0x0f, { Kind::MBC3, false, true, true } },
+        { 0x10, { Kind::MBC3, true, true, true } },
+        { 0x11, { Kind::MBC3 } },
+        { 0x12, { Kind::MBC3, true } },
+        { 0x13, { Kind::MBC3, true, true } },
+        { 0x19, { Kind::MBC5 } },
+        { 0x1a, { Kind::MBC5, true } },
+        { 0x1b, { Kind::MBC5, true, true } },
+        // With a rumble motor, which is ignored
+        { 0x1c, { Kind::MBC5 } },
+        { 0x1d, { Kind::MBC5, true } },
+        { 0x1e, { Kind::MBC5, true, true } },
+    } };
+
+    constexpr bool IsRAMEnable(const uint8_t value) { return (value & 0xf) == 0xa; }
+
+    // No MBC: at most 32 KiB of ROM and 8 KiB of RAM, always enabled
+    class NoMapper : public Mapper
+    {
+    public:
+        NoMapper() { mapping.ramEnabled = true; }
+        void Write(const Address, const uint8_t) override { }
+    };
+
+    class MBC1 : public Mapper
+    {
+    public:
+        void Write(const Address address, const uint8_t value) override
+        {
+            if (address <= 0x1fff)
+                mapping.ramEnabled = IsRAMEnable(value);
+            else if (address <= 0x3fff)
+                bank1 = std::max(value & 0x1f, 1);
+            else if (address <= 0x5fff)
+                bank2 = value & 3;
+            else
+                advancedMode = (value & 1) != 0;
+
+            // In advanced mode, the upper bits select the RAM bank and also
+            // apply to 0x0000..0x3fff
+            mapping.rom0 = advancedMode ? bank2 << 5 : 0;
+            mapping.rom1 = (bank2 << 5) | bank1;
+            mapping.ram = advancedMode ? bank2 : 0;
+        }
+
+        void SaveState(state::Writer& writer) const override
+        {
+            Mapper::SaveState(writer);
+            writer.Write(bank1);
+            writer.Write(bank2);
+            writer.Write(advancedMode);
+        }
+
+        void LoadState(state::Reader& reader) override
+        {
+            Mapper::LoadState(reader);
+            reader.Read(bank1);
+            reader.Read(bank2);
+            reader.Read(advancedMode);
+        }
+
+    private:
+        int bank1{1}, bank2{};
+        bool advancedMode{};
+    };
+
+    // 512 nibbles of built-in RAM, repeated over 0xa000..0xbfff
+    class MBC2 : public Mapper
+    {
+    public:
+        MBC2() { unusedRAMBits = 0xf0; }
+
+        void Write(const Address address, const uint8_t value) override
+        {
+            if (address > 0x3fff) return;
+            // Bit 8 of the address selects the register
+            if ((address & 0x100) == 0)
+                mapping.ramEnabled = IsRAMEnable(value);
+            else
+                mapping.rom1 = std::max(value & 0xf, 1);
+        }
+    };
+
+    class MBC3 : public Mapper
+    {
+    public:
+        MBC3(const Scheduler& scheduler, const bool hasClock)
+            : scheduler(scheduler), hasClock(hasClock)
+        {
+        }
+
+        void Write(const Address address, const uint8_t value) override
+        {
+            if (address <= 0x1fff) {
+                mapping.ramEnabled = IsRAMEnable(value);
+            } else if (address <= 0x3fff) {
+                mapping.rom1 = std::max(value & 0x7f, 1);
+            } else if (address <= 0x5fff) {
+                if (value <= 3) {
+                    mapping.ram = value;
+                    mapping.registerSelected = false;
+                } else if (hasClock && value >= ClockSeconds && value <= ClockFlags) {
+                    selectedRegister = value;
+                    mapping.registerSelected = true;
+                }
+            } else {
+                // Writing 0 and then 1 latches the clock
+                if (latch == 0 && value == 1) {
+                    Update();
+                    latched = clock;
+                }
+                latch = value;
+            }
+        }
+
+        uint8_t ReadRegister() override
+        {
+            return latched[selectedRegister - ClockSeconds];
+        }
+
+        void WriteRegister(const uint8_t value) override
+        {
+            Update();
+            constexpr std::array<uint8_t, 5> validBits{ 0x3f, 0x3f, 0x1f, 0xff, 0xc1 };
+            clock[selectedRegister - ClockSeconds] = value & validBits[selectedRegister - ClockSeconds];
+            // Writing the seconds restarts the current one
+            if (selectedRegister == ClockSeconds)
+                subSecond = 0;
+        }
+
+        void SaveState(state::Writer& writer) const override
+        {
+            Mapper::SaveState(writer);
+            writer.Write(selectedRegister);
+            writer.Write(latch);
+            writer.Write(clock);
+            writer.Write(latched);
+            writer.Write(lastUpdate);
+            writer.Write(subSecond);
+        }
+
+        void LoadState(state::Reader& reader) override
+        {
+            Mapper::LoadState(reader);
+            reader.Read(selectedRegister);
+            reader.Read(latch);
+            reader.Read(clock);
+            reader.Read(latched);
+            reader.Read(lastUpdate);
+            reader.Read(subSecond);
+        }
+
+    private:
+        static constexpr uint8_t ClockSeconds = 0x08;
+        static constexpr uint8_t ClockFlags = 0x0c;
+        static constexpr Cycle CyclesPerSecond = 4194304;
+        // Indices into clock; the flags hold bit 8 of the day counter,
+        // the halt flag (bit 6) and the day counter carry (bit 7)
+        enum { Seconds, Minutes, Hours, Days, Flags };
+
+        // Advances the clock to the current cycle
+        void Update()
+        {
+            const auto elapsed = scheduler.now - lastUpdate;
+            lastUpdate = scheduler.now;
+            if ((clock[Flags] & (1 << 6)) != 0) return;
+
+            subSecond += elapsed;
+            const auto seconds = subSecond / CyclesPerSecond;
+            subSecond %= CyclesPerSecond;
+            if (seconds == 0) return;
+
+            auto days = clock[Days] | ((clock[Flags] & 1) << 8);
+            auto total = clock[Seconds] + 60 * (clock[Minutes] + 60 * (clock[Hours] + 24 * static_cast<Cycle>(days))) + seconds;
+            clock[Seconds] = total % 60; total /= 60;
+            clock[Minutes] = total % 60; total /= 60;
+            clock[Hours] = total % 24; total /= 24;
+            if (total > 511)
+                clock[Flags] |= 1 << 7;
+            days = total % 512;
+            clock[Days] = days & 0xff;
+            clock[Flags] = (clock[Flags] & ~1) | (days >> 8);
+        }
+
+        const Scheduler& scheduler;
+        const bool hasClock;
+        uint8_t selectedRegister{ClockSeconds};
+        uint8_t latch{0xff};
+        std::array<uint8_t, 5> clock{};
+        std::array<uint8_t, 5> latched{};
+        Cycle lastUpdate{};
+        Cycle subSecond{};
+    };
+
+    class MBC5 : public Mapper
+    {
+    public:
+        void Write(const Address address, const uint8_t value) override
+        {
+            if (address <= 0x1fff)
+                mapping.ramEnabled = IsRAMEnable(value);
+            else if (address <= 0x2fff)
+                mapping.rom1 = (mapping.rom1 & 0x100) | value;
+            else if (address <= 0x3fff)
+                mapping.rom1 = (mapping.rom1 & 0xff) | ((value & 1) << 8);
+            else if (address <= 0x5fff)
+                mapping.ram = value & 0xf;
+        }
+    };
+}
+
+void Mapper::SaveState(state::Writer& writer) const
+{
+    writer.Write(mapping);
+}
+
+void Mapper::LoadState(state::Reader& reader)
+{
+    reader.Read(mapping);
+}
+
+namespace mapper {
+
+std::optional<CartridgeType> GetCartridgeType(const uint8_t code)
+{
+    for (const auto& [ c, type ]: cartridgeTypes) {
+        if (c == code)
+            return type;
+    }
+    return {};
+}
+
+std::unique_ptr<Mapper> Create(const CartridgeType& type, const Scheduler& scheduler)
+{
+    switch(type.kind) {
+        case Kind::None: return std::make_unique<NoMapper>();
+        case Kind::MBC1: return std::make_unique<MBC1>();
+        case Kind::MBC2: return std::make_unique<MBC2>();
+        case Kind::MBC3: return std::make_unique<MBC3>(scheduler, type.clock);
+        case Kind::MBC5: return std::make_unique<MBC5>();
+    }
+    return {};
+}
+
+}
+
+}
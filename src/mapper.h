@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include "scheduler.h"
+#include "types.h"
+
+namespace gb {
+
+namespace state { class Reader; class Writer; }
+
+// The memory bank controller of a cartridge: it decodes the writes to
+// 0x0000..0x7fff and decides which banks are visible. The cartridge turns
+// the resulting mapping into host pointers whenever it changes
+class Mapper
+{
+public:
+    static constexpr size_t ROMBankSize = 16384;
+    static constexpr size_t RAMBankSize = 8192;
+
+    struct Mapping {
+        // Banks visible at 0x0000..0x3fff and 0x4000..0x7fff
+        size_t rom0{0}, rom1{1};
+        // Bank visible at 0xa000..0xbfff
+        size_t ram{0};
+        bool ramEnabled{};
+        // An I/O register (the MBC3 clock) replaces the RAM; accesses go
+        // through ReadRegister()/WriteRegister()
+        bool registerSelected{};
+    };
+
+    virtual ~Mapper() = default;
+
+    const Mapping& GetMapping() const { return mapping; }
+    // Bits of every RAM byte which are not stored and read as 1 (MBC2)
+    uint8_t GetUnusedRAMBits() const { return unusedRAMBits; }
+
+    // Only for writes to 0x0000..0x7fff
+    virtual void Write(const Address address, const uint8_t value) = 0;
+    virtual uint8_t ReadRegister() { return 0xff; }
+    virtual void WriteRegister(const uint8_t) { }
+
+    virtual void SaveState(state::Writer& writer) const;
+    virtual void LoadState(state::Reader& reader);
+
+protected:
+    Mapping mapping;
+    uint8_t unusedRAMBits{};
+};
+
+namespace mapper {
+    enum class Kind { None, MBC1, MBC2, MBC3, MBC5 };
+
+    // What the cartridge type in the header (0x147) consists of
+    struct CartridgeType {
+        Kind kind{};
+        bool ram{}, battery{}, clock{};
+    };
+
+    // Empty if the type is not supported
+    std::optional<CartridgeType> GetCartridgeType(const uint8_t code);
+
+    // The clock of an MBC3 follows the emulated time, so replays and
+    // snapshots are deterministic
+    std::unique_ptr<Mapper> Create(const CartridgeType& type, const Scheduler& scheduler);
+}
+
+}
@@ -1,78 +1,19 @@
 #include "memory.h"
+#include <cstring>
 #include <iostream>
 #include <string>
+#include "block_cache.h"
 #include "bootstrap_rom.h"
+#include "cartridge.h"
 #include "io.h"
+#include "state.h"
+#include "tile_cache.h"
+#include "trace.h"
 
 #include "fmt/core.h"
 
 namespace gb {
     namespace {
-        std::string IORegisterToString(const Address address) {
-            switch(address) {
-                case io::P1: return "P1";
-                case io::SB: return "SB";
-                case io::SC: return "SC";
-                case io::DIV: return "DIV";
-                case io::TIMA: return "TIMA";
-                case io::TMA: return "TMA";
-                case io::TAC: return "TAC";
-                case io::IF: return "IF";
-                case io::NR10: return "NR10";
-                case io::NR11: return "NR11";
-                case io::NR12: return "NR12";
-                case io::NR13: return "NR13";
-                case io::NR14: return "NR14";
-                case io::NR21: return "NR21";
-                case io::NR22: return "NR22";
-                case io::NR23: return "NR23";
-                case io::NR24: return "NR24";
-                case io::NR30: return "NR30";
-                case io::NR31: return "NR31";
-                case io::NR32: return "NR32";
-                case io::NR33: return "NR33";
-                case io::NR34: return "NR34";
-                case io::NR41: return "NR41";
-                case io::NR42: return "NR42";
-                case io::NR43: return "NR43";
-                case io::NR44: return "NR44";
-                case io::NR50: return "NR50";
-                case io::NR51: return "NR51";
-                case io::NR52: return "NR52";
-                case io::AUD3WAVERAM+0: return "AUD3WAVERAM+0";
-                case io::AUD3WAVERAM+1: return "AUD3WAVERAM+1";
-                case io::AUD3WAVERAM+2: return "AUD3WAVERAM+2";
-                case io::AUD3WAVERAM+3: return "AUD3WAVERAM+3";
-                case io::AUD3WAVERAM+4: return "AUD3WAVERAM+4";
-                case io::AUD3WAVERAM+5: return "AUD3WAVERAM+5";
-                case io::AUD3WAVERAM+6: return "AUD3WAVERAM+6";
-                case io::AUD3WAVERAM+7: return "AUD3WAVERAM+7";
-                case io::AUD3WAVERAM+8: return "AUD3WAVERAM+8";
-                case io::AUD3WAVERAM+9: return "AUD3WAVERAM+9";
-                case io::AUD3WAVERAM+10: return "AUD3WAVERAM+a";
-                case io::AUD3WAVERAM+11: return "AUD3WAVERAM+b";
-                case io::AUD3WAVERAM+12: return "AUD3WAVERAM+c";
-                case io::AUD3WAVERAM+13: return "AUD3WAVERAM+d";
-                case io::AUD3WAVERAM+14: return "AUD3WAVERAM+e";
-                case io::AUD3WAVERAM+15: return "AUD3WAVERAM+f";
-                case io::LCDC: return "LCDC";
-                case io::STAT: return "STAT";
-                case io::SCY: return "SCY";
-                case io::SCX: return "SCX";
-                case io::LY: return "LY";
-                case io::LYC: return "LYC";
-                case io::DMA: return "DMA";
-                case io::BGP: return "BGP";
-                case io::OBP0: return "OBP0";
-                case io::OBP1: return "OBP1";
-                case io::WY: return "WY";
-                case io::WX: return "WX";
-                case io::IE: return "IE";
-                case io::DMG: return "DMG";
-            }
-            return fmt::format("{:x}", address);
-        }
-
         inline constexpr Address DMGROMEnabled = 0xff50;
 
         constexpr bool IsInRange(const Address address, const Address start, const Address end) {
@@ -111,17 +52,63 @@ namespace gb {
         }
     }
 
-    namespace cartridge {
-        uint8_t Read_u8(const Address);
-        void Write_u8(const Address, uint8_t);
+    Memory::Memory(Scheduler& scheduler, IO& io, Cartridge& cartridge)
+        : scheduler(scheduler), io(io), cartridge(cartridge)
+    {
+        MapRAM();
+        MapCartridge();
+    }
+
+    void Memory::SetTrace(trace::Buffer* buffer)
+    {
+        trace = buffer;
+        enableTracing = buffer != nullptr;
+        MapRAM();
+        MapCartridge();
+    }
+
+    void Memory::MapRAM()
+    {
+        auto mapPages = [&](const Address start, const Address end, const Address target) {
+            for(int page = start >> PageShift; page <= (end >> PageShift); ++page) {
+                const auto offset = target + (page << PageShift) - start;
+                auto ptr = enableTracing ? nullptr : &data[offset];
+                readPage[page] = ptr;
+                writePage[page] = IsWriteTrapped(offset >> PageShift) ? nullptr : ptr;
+            }
+        };
+        mapPages(memory_map::VRAMStart, memory_map::VRAMEnd, memory_map::VRAMStart);
+        mapPages(memory_map::WRAM0Start, memory_map::WRAM1End, memory_map::WRAM0Start);
+        mapPages(memory_map::MirrorStart, memory_map::MirrorEnd, memory_map::WRAM0Start);
+        // OAM shares its page with the unusable 0xfea0..0xfeff range, and
+        // HRAM shares its page with I/O: both always take the slow path
+    }
+
+    void Memory::MapCartridge()
+    {
+        ++codeGeneration;
+        for(int page = memory_map::Cartridge0Start >> PageShift; page <= (memory_map::Cartridge0End >> PageShift); ++page) {
+            readPage[page] = enableTracing ? nullptr : cartridge.GetReadPointer(page << PageShift);
+            writePage[page] = nullptr; // MBC registers
+        }
+        for(int page = memory_map::Cartridge1Start >> PageShift; page <= (memory_map::Cartridge1End >> PageShift); ++page) {
+            readPage[page] = enableTracing ? nullptr : cartridge.GetReadPointer(page << PageShift);
+            writePage[page] = enableTracing ? nullptr : cartridge.GetWritePointer(page << PageShift);
+        }
+        if (io.IsBootstrapROMEnabled())
+            readPage[memory_map::BootstrapROMStart >> PageShift] = nullptr;
+    }
+
+    uint8_t Memory::SlowRead_u8(const Address address) {
+        const auto value = ReadMapped_u8(address);
+        if (trace)
+            trace->RecordMemoryAccess(trace::RecordType::MemoryRead, address, value);
+        return value;
     }
 
-    uint8_t Memory::Read_u8(Address address) {
+    uint8_t Memory::ReadMapped_u8(Address address) {
         if (IsIO(address)) {
-            const auto value = io.Read(address);
-            if (enableTracing)
-                std::cout << fmt::format("*** read (i/o): {} ({:x}) -> {:x}\n", IORegisterToString(address), address, value);
-            return value;
+            return io.Read(address);
         }
 
         if (IsBootstrapROM(address) && io.IsBootstrapROMEnabled()) {
@@ -129,14 +116,14 @@ namespace gb {
         }
 
         if (IsCartridge(address)) {
-            return cartridge::Read_u8(address);
+            return cartridge.Read_u8(address);
         }
 
         if (IsRAM(address)) {
-            if (enableTracing)
-                std::cout << fmt::format("*** read: ram @ {:x} -> {:x}\n", address, data[address]);
             if (IsInRange(address, memory_map::MirrorStart, memory_map::MirrorEnd))
                 address = (address - memory_map::MirrorStart) + memory_map::WRAM0Start;
+            if (IsInRange(address, memory_map::OAMStart, memory_map::OAMEnd) && IsDMAActive())
+                return 0xff;
             return data[address];
         }
 
@@ -150,34 +137,53 @@ namespace gb {
         return (hi << 8) | lo;
     }
 
-    void Memory::Write_u8(Address address, const uint8_t value) {
-        // XXX This shouldn't be here
-        if (address == io::DMA) {
-            // XXX We need to properly delay, block everything except HRAM etc...
-            const uint16_t sourceAddress = value << 8;
-            const uint16_t destAddress = 0xfe00;
-            for(unsigned int n = 0; n < 0xa0; ++n) {
-                Write_u8(destAddress + n, Read_u8(sourceAddress + n));
-            }
-        }
+    void Memory::SlowWrite_u8(const Address address, const uint8_t value) {
+        if (trace)
+            trace->RecordMemoryAccess(trace::RecordType::MemoryWrite, address, value);
+        WriteMapped_u8(address, value);
+    }
+
+    void Memory::WriteMapped_u8(Address address, const uint8_t value) {
+        if (address == io::DMA)
+            StartDMA(value);
 
         if (IsCartridge(address)) {
-            return cartridge::Write_u8(address, value);
+            // A bank switch, or the first write to a clean RAM page
+            if (cartridge.Write_u8(address, value))
+                MapCartridge();
+            return;
         }
 
         if (IsRAM(address)) {
-            if (enableTracing)
-                std::cout << fmt::format("*** write: ram write @ {:x} <- {:x}\n", address, value);
             if (IsInRange(address, memory_map::MirrorStart, memory_map::MirrorEnd))
                 address = (address - memory_map::MirrorStart) + memory_map::WRAM0Start;
+            if (IsInRange(address, memory_map::OAMStart, memory_map::OAMEnd) && IsDMAActive())
+                return;
+            if (auto& code = codePage[address >> PageShift]; code) {
+                code = false;
+                ++codeGeneration;
+                if (blockCache)
+                    blockCache->InvalidatePage(address & ~PageMask);
+                MapRAM();
+            }
+            if (auto& tiles = tilePage[address >> PageShift]; tiles) {
+                tiles = false;
+                if (tileCache)
+                    tileCache->InvalidatePage(address & ~PageMask);
+                MapRAM();
+            }
+            if (trackDirty && !dirtyPage[address >> PageShift]) {
+                dirtyPage[address >> PageShift] = true;
+                MapRAM();
+            }
             data[address] = value;
             return;
         }
 
         if (IsIO(address)) {
-            if (enableTracing)
-                std::cout << fmt::format("*** write: i/o write @ {} ({:x}) <- {:x}\n", IORegisterToString(address), address, value);
             io.Write(address, value);
+            if (address == io::DMG)
+                MapCartridge();
             return;
         }
 
@@ -189,10 +195,79 @@ namespace gb {
         Write_u8(address + 1, static_cast<uint8_t>(value >> 8));
     }
 
-    uint8_t Memory::At_u8(Address address) const
+    void Memory::StartDMA(const uint8_t sourcePage)
+    {
+        constexpr Address OAMSize = memory_map::OAMEnd - memory_map::OAMStart + 1;
+        // Sources above WRAM read from its mirror, as on the DMG
+        const Address source = (sourcePage >= 0xe0 ? sourcePage - 0x20 : sourcePage) << PageShift;
+        if (const auto page = readPage[source >> PageShift]; page) {
+            memcpy(&data[memory_map::OAMStart], page, OAMSize);
+        } else {
+            // The bootstrap ROM overlay, or tracing is enabled
+            for(Address n = 0; n < OAMSize; ++n)
+                data[memory_map::OAMStart + n] = ReadMapped_u8(source + n);
+        }
+        // OAM is never mapped, so only the flag needs to be set
+        if (trackDirty)
+            dirtyPage[memory_map::OAMStart >> PageShift] = true;
+        dmaEnd = scheduler.now + DMACycles;
+    }
+
+    void Memory::TrackCode(Address address)
+    {
+        if (IsInRange(address, memory_map::MirrorStart, memory_map::MirrorEnd))
+            address = (address - memory_map::MirrorStart) + memory_map::WRAM0Start;
+        if (auto& code = codePage[address >> PageShift]; !code) {
+            code = true;
+            MapRAM();
+        }
+    }
+
+    void Memory::SaveState(state::Writer& writer) const
+    {
+        writer.Write(dmaEnd);
+        writer.WriteRegion(&data[memory_map::VRAMStart], data.size() - memory_map::VRAMStart);
+    }
+
+    void Memory::LoadState(state::Reader& reader)
+    {
+        reader.Read(dmaEnd);
+        reader.ReadRegion(&data[memory_map::VRAMStart], data.size() - memory_map::VRAMStart);
+        // The block and tile caches are cleared as well, nothing is known
+        // to hold code or decoded tiles
+        codePage.fill(false);
+        tilePage.fill(false);
+        MapRAM();
+        MapCartridge();
+    }
+
+    void Memory::SetDirtyTracking(const bool enabled)
+    {
+        trackDirty = enabled;
+        cartridge.SetDirtyTracking(enabled);
+        ClearDirtyPages();
+    }
+
+    void Memory::ClearDirtyPages()
+    {
+        dirtyPage.fill(false);
+        cartridge.ClearDirtyPages();
+        MapRAM();
+        MapCartridge();
+    }
+
+    void Memory::TrackTiles(const Address address)
+    {
+        if (auto& tiles = tilePage[address >> PageShift]; !tiles) {
+            tiles = true;
+            MapRAM();
+        }
+    }
+
+    uint8_t Memory::SlowAt_u8(Address address) const
     {
         if (IsBootstrapROM(address) && io.IsBootstrapROMEnabled()) return bootstrap_rom::Read_u8(address);
-        if (IsCartridge(address)) return cartridge::Read_u8(address);
+        if (IsCartridge(address)) return cartridge.Read_u8(address);
         if (IsRAM(address)) {
             if (IsInRange(address, memory_map::MirrorStart, memory_map::MirrorEnd))
                 address = (address - memory_map::MirrorStart) + memory_map::WRAM0Start;
@@ -202,5 +277,4 @@ namespace gb {
         return 0xff;
     }
 
-
 }
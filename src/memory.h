@@ -2,16 +2,41 @@
 
 #include <array>
 #include <cstdint>
+#include "scheduler.h"
 #include "types.h"
 
 namespace gb {
     struct IO;
+    class BlockCache;
+    class TileCache;
+    class Cartridge;
+    namespace trace { class Buffer; }
+    namespace state { class Reader; class Writer; }
 
     struct Memory {
-        Memory(IO& io) : io(io) { }
+        Memory(Scheduler& scheduler, IO& io, Cartridge& cartridge);
 
-        uint8_t Read_u8(Address address);
-        uint8_t At_u8(Address address) const;
+        // Every 256-byte page has a host pointer for reads and writes; if
+        // it is nullptr, the access needs special handling (I/O, MBC
+        // registers, the bootstrap ROM overlay, tracing) and goes through
+        // the slow path instead
+        static constexpr int PageShift = 8;
+        static constexpr int NumberOfPages = 65536 >> PageShift;
+        static constexpr Address PageMask = (1 << PageShift) - 1;
+
+        uint8_t Read_u8(Address address)
+        {
+            if (const auto page = readPage[address >> PageShift]; page)
+                return page[address & PageMask];
+            return SlowRead_u8(address);
+        }
+
+        uint8_t At_u8(Address address) const
+        {
+            if (const auto page = readPage[address >> PageShift]; page)
+                return page[address & PageMask];
+            return SlowAt_u8(address);
+        }
 
         template<typename Iterator>
         void Fill(Address base, Iterator start, Iterator end)
@@ -24,11 +49,85 @@ namespace gb {
 
         uint16_t Read_u16(const Address address);
 
-        void Write_u8(Address address, const uint8_t value);
+        void Write_u8(Address address, const uint8_t value)
+        {
+            if (const auto page = writePage[address >> PageShift]; page) {
+                page[address & PageMask] = value;
+                return;
+            }
+            SlowWrite_u8(address, value);
+        }
+
         void Write_u16(const Address address, const uint16_t value);
 
+        // Records every access in the trace buffer; as this needs all
+        // accesses to take the slow path, nullptr restores the page table
+        void SetTrace(trace::Buffer* buffer);
+
+        // Rebuilds the page table entries covering the cartridge, i.e. after
+        // a bank switch or when the bootstrap ROM is unmapped
+        void MapCartridge();
+
+        const uint8_t* GetPagePointer(const int page) const { return readPage[page]; }
+
+        // OAM DMA, started by writing the source page to io::DMA. The 160
+        // bytes are copied at once, but OAM stays busy (reading 0xff and
+        // ignoring writes) until the transfer would have completed
+        static constexpr Cycle DMACycles = 160 * 4;
+        void StartDMA(const uint8_t sourcePage);
+        bool IsDMAActive() const { return scheduler.now < dmaEnd; }
+
+        // Marks the WRAM page holding address as containing decoded code:
+        // the next write to it is trapped and invalidates the block cache
+        void TrackCode(Address address);
+        // Likewise for a VRAM page holding decoded tiles
+        void TrackTiles(const Address address);
+
+        // Everything but the cartridge (which is mapped by the page table,
+        // not stored in data[]). Loading rebuilds the page table, so the
+        // cartridge and I/O state must be loaded first
+        void SaveState(state::Writer& writer) const;
+        void LoadState(state::Reader& reader);
+
+        // Dirty page tracking, for incremental snapshots: after
+        // ClearDirtyPages(), the first write to every page of data[] (and
+        // of the cartridge RAM) is trapped and marks the page as dirty
+        void SetDirtyTracking(const bool enabled);
+        void ClearDirtyPages();
+        // Indexed by the page within data[], like TrackCode()
+        bool IsPageDirty(const int page) const { return dirtyPage[page]; }
+
+        Scheduler& scheduler;
         IO& io;
-        bool enableTracing;
+        Cartridge& cartridge;
+        BlockCache* blockCache{};
+        TileCache* tileCache{};
+        // Changes whenever code that has been read may have changed, i.e.
+        // on a bank switch or a write to a tracked page
+        uint32_t codeGeneration{};
+        bool enableTracing{};
+        trace::Buffer* trace{};
         std::array<uint8_t, 65536> data{};
+
+    private:
+        uint8_t SlowRead_u8(const Address address);
+        uint8_t SlowAt_u8(Address address) const;
+        void SlowWrite_u8(const Address address, const uint8_t value);
+        uint8_t ReadMapped_u8(Address address);
+        void WriteMapped_u8(Address address, const uint8_t value);
+        void MapRAM();
+        bool IsWriteTrapped(const int page) const
+        {
+            return codePage[page] || tilePage[page] || (trackDirty && !dirtyPage[page]);
+        }
+
+        std::array<const uint8_t*, NumberOfPages> readPage{};
+        std::array<uint8_t*, NumberOfPages> writePage{};
+        // Indexed by the page within data[], so mirrors share the flag
+        std::array<bool, NumberOfPages> codePage{};
+        std::array<bool, NumberOfPages> tilePage{};
+        std::array<bool, NumberOfPages> dirtyPage{};
+        bool trackDirty{};
+        Cycle dmaEnd{};
     };
 }
@@ -0,0 +1,120 @@
+#include "movie.h"
+#include "hash.h"
+#include "state.h"
+#include "types.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "fmt/core.h"
+
+namespace gb {
+
+namespace {
+    // File layout: the magic, the ROM hash (uint64_t), the bootROM flag,
+    // the length (uint32_t) and the number of inputs (uint32_t) followed
+    // by the inputs, ditto for the checkpoints; all in host byte order
+    constexpr char magic[8] = { 'G', 'B', 'M', 'O', 'V', 'I', 'E', '3' };
+}
+
+void Movie::RecordInput(const uint32_t frame, const uint8_t buttons)
+{
+    const uint8_t current = inputs.empty() ? 0 : inputs.back().buttons;
+    if (buttons != current)
+        inputs.push_back({ frame, buttons });
+}
+
+void Movie::Save(const std::string& path) const
+{
+    state::Save(path, Encode());
+}
+
+Movie Movie::Load(const std::string& path)
+{
+    return Decode(state::Load(path));
+}
+
+std::vector<uint8_t> Movie::Encode() const
+{
+    std::vector<uint8_t> data;
+    state::Writer writer(data);
+    writer.Write(magic);
+    writer.Write(romHash);
+    writer.Write(bootROM);
+    writer.Write(length);
+    writer.Write(static_cast<uint32_t>(inputs.size()));
+    for (const auto& input: inputs) {
+        writer.Write(input.frame);
+        writer.Write(input.buttons);
+    }
+    writer.Write(static_cast<uint32_t>(checkpoints.size()));
+    for (const auto& checkpoint: checkpoints) {
+        writer.Write(checkpoint.frame);
+        writer.Write(checkpoint.hash);
+    }
+    return data;
+}
+
+Movie Movie::Decode(const std::vector<uint8_t>& data)
+{
+    state::Reader reader(data);
+    char fileMagic[sizeof(magic)]{};
+    if (data.size() >= sizeof(fileMagic))
+        reader.Read(fileMagic);
+    if (memcmp(fileMagic, magic, sizeof(magic)) != 0)
+        throw std::runtime_error("not a movie file");
+
+    // Every entry takes up at least five bytes
+    const auto readCount = [&]() {
+        const auto count = reader.Read<uint32_t>();
+        if (count > data.size() / 5)
+            throw std::runtime_error("movie truncated");
+        return count;
+    };
+
+    Movie movie;
+    reader.Read(movie.romHash);
+    reader.Read(movie.bootROM);
+    reader.Read(movie.length);
+    movie.inputs.resize(readCount());
+    for (auto& input: movie.inputs) {
+        reader.Read(input.frame);
+        reader.Read(input.buttons);
+    }
+    movie.checkpoints.resize(readCount());
+    for (auto& checkpoint: movie.checkpoints) {
+        reader.Read(checkpoint.frame);
+        reader.Read(checkpoint.hash);
+    }
+    return movie;
+}
+
+MoviePlayer::MoviePlayer(const Movie& movie)
+    : movie(movie)
+{
+}
+
+uint8_t MoviePlayer::StartFrame(const uint32_t frame, const FrameBuffer& frameBuffer)
+{
+    for (; nextCheckpoint < movie.checkpoints.size() && movie.checkpoints[nextCheckpoint].frame <= frame; ++nextCheckpoint) {
+        const auto& checkpoint = movie.checkpoints[nextCheckpoint];
+        if (checkpoint.frame != frame) continue;
+        const auto hash = HashFrameBuffer(frameBuffer);
+        if (hash != checkpoint.hash) {
+            if (mismatch.empty())
+                mismatch = fmt::format("framebuffer differs at frame {}: hash {:016x}, expected {:016x}", checkpoint.frame, hash, checkpoint.hash);
+        } else {
+            ++matchedCheckpoints;
+        }
+    }
+    for (; nextInput < movie.inputs.size() && movie.inputs[nextInput].frame <= frame; ++nextInput)
+        buttons = movie.inputs[nextInput].buttons;
+    return buttons;
+}
+
+uint64_t HashFrameBuffer(const FrameBuffer& frameBuffer)
+{
+    return CalculateHash(frameBuffer.data(), frameBuffer.size());
+}
+
+}
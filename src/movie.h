@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "video.h"
+
+namespace gb {
+
+// Recorded input of a machine started from reset: the buttons pressed
+// whenever they changed, plus framebuffer hashes to check a replay against.
+// Frame n is the one starting after n frames have completed; its input
+// stays in effect for the entire frame
+struct Movie
+{
+    struct Input {
+        uint32_t frame;
+        uint8_t buttons;
+    };
+    struct Checkpoint {
+        uint32_t frame;
+        // HashFrameBuffer() at the start of the frame
+        uint64_t hash;
+    };
+
+    // Only stores the buttons when they differ from the last recorded ones
+    void RecordInput(const uint32_t frame, const uint8_t buttons);
+
+    void Save(const std::string& path) const;
+    static Movie Load(const std::string& path);
+    // The file contents, e.g. for sending a movie elsewhere; Decode()
+    // throws std::runtime_error just like Load()
+    std::vector<uint8_t> Encode() const;
+    static Movie Decode(const std::vector<uint8_t>& data);
+
+    uint64_t romHash{};
+    bool bootROM{};
+    // Number of frames recorded
+    uint32_t length{};
+    std::vector<Input> inputs;
+    std::vector<Checkpoint> checkpoints;
+};
+
+// Replays a movie frame by frame, checking its checkpoints along the way
+class MoviePlayer
+{
+public:
+    // The movie must outlive the player
+    explicit MoviePlayer(const Movie& movie);
+
+    // Call at the start of every frame, once frame frames have completed,
+    // with the framebuffer as it is then. Returns the buttons to hold
+    // during the frame
+    uint8_t StartFrame(const uint32_t frame, const FrameBuffer& frameBuffer);
+
+    size_t GetNumberOfMatchedCheckpoints() const { return matchedCheckpoints; }
+    // Describes the first checkpoint that did not match; empty otherwise
+    const std::string& GetMismatch() const { return mismatch; }
+
+private:
+    const Movie& movie;
+    size_t nextInput{};
+    size_t nextCheckpoint{};
+    size_t matchedCheckpoints{};
+    uint8_t buttons{};
+    std::string mismatch;
+};
+
+uint64_t HashFrameBuffer(const FrameBuffer& frameBuffer);
+
+}
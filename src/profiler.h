@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+namespace gb {
+    namespace subsystem {
+        enum Type {
+            CPU,
+            Video,
+            Audio,
+            IO,
+            NumberOfTypes
+        };
+    }
+
+    // Wall clock time spent per subsystem. The devices account for their
+    // own time; the CPU gets whatever remains of the measured total
+    struct Profiler {
+        using Clock = std::chrono::steady_clock;
+
+        Profiler()
+        {
+            // Cost of reading the clock itself, for intervals so short that
+            // it would otherwise dominate
+            clockOverhead = Clock::duration::max();
+            for (int n = 0; n < 1000; ++n) {
+                const auto start = Clock::now();
+                clockOverhead = std::min(clockOverhead, Clock::now() - start);
+            }
+        }
+
+        std::array<Clock::duration, subsystem::NumberOfTypes> time{};
+        Clock::duration clockOverhead{};
+    };
+
+    // Adds the lifetime of the object to the given subsystem, if profiling
+    // is enabled at all
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer(Profiler* profiler, const subsystem::Type type)
+            : profiler(profiler), type(type)
+        {
+            if (profiler) start = Profiler::Clock::now();
+        }
+
+        ~ScopedTimer()
+        {
+            if (profiler) profiler->time[type] += Profiler::Clock::now() - start;
+        }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        Profiler* profiler;
+        const subsystem::Type type;
+        Profiler::Clock::time_point start;
+    };
+}
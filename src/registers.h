@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include "types.h"
+
+namespace gb::cpu {
+    enum class Flag : uint8_t {
+        z = (1 << 7), // Zero
+        n = (1 << 6), // Add/Sub (BCD)
+        h = (1 << 5), // Half carry(BCD)
+        c = (1 << 4) // Carry
+    };
+
+    struct Registers {
+        uint8_t a{}, b{}, c{}, d{}, e{}, h{}, l{};
+        uint8_t fl{};
+        bool ime{};
+        bool halt{};
+        bool stop{};
+        Address pc{}, sp{};
+    };
+
+    namespace flag {
+        inline constexpr uint8_t mask = 0xf0;
+
+        constexpr void Set(Registers& regs, const Flag flag)
+        {
+            regs.fl |= static_cast<uint8_t>(flag);
+        }
+
+        constexpr void Clear(Registers& regs, const Flag flag)
+        {
+            regs.fl &= ~static_cast<uint8_t>(flag);
+        }
+
+        constexpr void Assign(Registers& regs, const Flag flag, const bool set)
+        {
+            if (set)
+                Set(regs, flag);
+            else
+                Clear(regs, flag);
+        }
+
+        constexpr bool IsSet(const Registers& regs, const Flag flag)
+        {
+            return (regs.fl & static_cast<uint8_t>(flag)) != 0;
+        }
+
+        constexpr bool IsClear(const Registers& regs, const Flag flag)
+        {
+            return !IsSet(regs, flag);
+        }
+    }
+}
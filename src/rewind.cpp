@@ -0,0 +1,113 @@
+#include "rewind.h"
+#include "system.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace gb {
+
+namespace {
+    // Only VRAM and above is RAM, see Memory::SaveState()
+    constexpr int FirstMemoryPage = memory_map::VRAMStart >> Memory::PageShift;
+    static_assert(Memory::PageMask + 1 == Cartridge::RAMPageSize);
+    constexpr size_t PageSize = Cartridge::RAMPageSize;
+}
+
+Rewind::Rewind(System& system, const size_t maxFrames, const size_t budget)
+    : system(system), maxFrames(maxFrames), budget(budget)
+{
+    system.memory.SetDirtyTracking(true);
+}
+
+Rewind::~Rewind()
+{
+    system.memory.SetDirtyTracking(false);
+}
+
+void Rewind::Record()
+{
+    if (restoredFrame) {
+        // Continuing from a restored frame: the frames after it are no
+        // longer what happened, and at least the frames up to the next
+        // keyframe must remain usable
+        while (frames.size() > *restoredFrame + 1) {
+            memoryUsage -= frames.back().GetSize();
+            frames.pop_back();
+        }
+        framesSinceKeyframe = 0;
+        for (auto it = frames.rbegin(); it != frames.rend() && !it->keyframe; ++it)
+            ++framesSinceKeyframe;
+        restoredFrame.reset();
+    }
+
+    auto& memory = system.memory;
+    auto& cartridge = system.cartridge;
+    Frame frame;
+    frame.keyframe = frames.empty() || ++framesSinceKeyframe >= KeyframeInterval;
+    if (frame.keyframe)
+        framesSinceKeyframe = 0;
+    system.SaveState(frame.state, false);
+    for (int page = FirstMemoryPage; page < Memory::NumberOfPages; ++page) {
+        if (frame.keyframe || memory.IsPageDirty(page))
+            frame.memoryPages.push_back(page);
+    }
+    for (size_t page = 0; page < cartridge.GetNumberOfRAMPages(); ++page) {
+        if (frame.keyframe || cartridge.IsRAMPageDirty(page))
+            frame.cartridgePages.push_back(page);
+    }
+    frame.contents.resize((frame.memoryPages.size() + frame.cartridgePages.size()) * PageSize);
+    auto out = frame.contents.data();
+    for (const auto page: frame.memoryPages) {
+        memcpy(out, &memory.data[page * PageSize], PageSize);
+        out += PageSize;
+    }
+    for (const auto page: frame.cartridgePages) {
+        memcpy(out, cartridge.GetRAMPage(page), PageSize);
+        out += PageSize;
+    }
+    memory.ClearDirtyPages();
+
+    memoryUsage += frame.GetSize();
+    frames.push_back(std::move(frame));
+
+    // Drop the oldest keyframe and its deltas, but never the newest one
+    while (memoryUsage > budget || frames.size() > maxFrames) {
+        const auto next = std::find_if(frames.begin() + 1, frames.end(), [](const auto& f) { return f.keyframe; });
+        if (next == frames.end()) break;
+        for (auto it = frames.begin(); it != next; ++it)
+            memoryUsage -= it->GetSize();
+        frames.erase(frames.begin(), next);
+    }
+}
+
+void Rewind::ApplyPages(const Frame& frame)
+{
+    auto in = frame.contents.data();
+    for (const auto page: frame.memoryPages) {
+        memcpy(&system.memory.data[page * PageSize], in, PageSize);
+        in += PageSize;
+    }
+    for (const auto page: frame.cartridgePages) {
+        memcpy(system.cartridge.GetRAMPage(page), in, PageSize);
+        in += PageSize;
+    }
+}
+
+void Rewind::Restore(const size_t n)
+{
+    size_t keyframe = n;
+    while (!frames[keyframe].keyframe)
+        --keyframe;
+    for (size_t index = keyframe; index <= n; ++index)
+        ApplyPages(frames[index]);
+    system.LoadState(frames[n].state);
+    system.memory.ClearDirtyPages();
+    restoredFrame = n;
+
+    // Rendering the frame brings the machine to the start of the next one
+    system.video.GetRenderFlagAndReset();
+    for (int cycles = 0; cycles < 2 * System::CyclesPerFrame && !system.video.GetRenderFlagAndReset(); )
+        cycles += system.Run(System::CyclesPerFrame);
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <vector>
+
+namespace gb {
+
+struct System;
+
+// Keeps up to maxFrames of the most recent frames of a machine within a
+// memory budget, so it can be returned to any of them. Every frame holds the device state
+// without memory, plus only the pages of RAM and external RAM written
+// since the frame before; every KeyframeInterval frames all pages are
+// stored, and the oldest frames are dropped a keyframe at a time
+class Rewind
+{
+public:
+    static constexpr size_t DefaultBudget = 64 << 20;
+    static constexpr size_t KeyframeInterval = 60;
+
+    // Enables dirty page tracking on the machine for as long as this exists
+    Rewind(System& system, const size_t maxFrames, const size_t budget = DefaultBudget);
+    ~Rewind();
+
+    Rewind(const Rewind&) = delete;
+    Rewind& operator=(const Rewind&) = delete;
+
+    // Records the current state as the newest frame; this must happen at
+    // the start of every frame, i.e. when the render flag has been set
+    void Record();
+
+    // Returns the machine to the start of recorded frame n (0 being the
+    // oldest) and runs it to the end of that frame, so the framebuffer
+    // shows it. Restoring does not drop any frames, so it can be repeated
+    // for any n until the next Record() discards the frames after n
+    void Restore(const size_t n);
+
+    size_t GetNumberOfFrames() const { return frames.size(); }
+    size_t GetMemoryUsage() const { return memoryUsage; }
+
+private:
+    struct Frame {
+        bool keyframe{};
+        std::vector<uint8_t> state;
+        // Pages of Memory::data and of the cartridge RAM, in that order
+        std::vector<uint8_t> memoryPages;
+        std::vector<uint8_t> cartridgePages;
+        std::vector<uint8_t> contents;
+
+        size_t GetSize() const
+        {
+            return sizeof(Frame) + state.size() + memoryPages.size() + cartridgePages.size() + contents.size();
+        }
+    };
+
+    void ApplyPages(const Frame& frame);
+
+    System& system;
+    const size_t maxFrames;
+    const size_t budget;
+    std::deque<Frame> frames;
+    size_t memoryUsage{};
+    size_t framesSinceKeyframe{};
+    std::optional<size_t> restoredFrame;
+};
+
+}
@@ -0,0 +1,106 @@
+#include "rom.h"
+#include "hash.h"
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace gb {
+
+namespace {
+    std::vector<uint8_t> ReadFile(const std::string& path)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs)
+            throw std::runtime_error("unable to open file");
+
+        std::vector<uint8_t> contents;
+        if (ifs.seekg(0, std::ios::end); ifs) {
+            contents.resize(ifs.tellg());
+            ifs.seekg(0);
+            ifs.read(reinterpret_cast<char*>(contents.data()), contents.size());
+        } else {
+            // Not seekable: read whatever comes
+            ifs.clear();
+            contents.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        }
+        if (ifs.bad())
+            throw std::runtime_error("read error");
+        return contents;
+    }
+
+    // Returns the mapping of the file, or nullptr if it cannot be mapped
+    void* MapFile(const std::string& path, size_t& length)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("unable to open file");
+
+        void* mapping = nullptr;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            length = st.st_size;
+            mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED)
+                mapping = nullptr;
+        }
+        close(fd);
+        return mapping;
+    }
+
+    std::mutex cacheMutex;
+    std::multimap<uint64_t, std::weak_ptr<const ROM>> cache;
+}
+
+ROM::ROM(std::vector<uint8_t> contents)
+    : contents(std::move(contents))
+{
+    bytes = this->contents.data();
+    length = this->contents.size();
+    hash = CalculateHash(bytes, length);
+}
+
+ROM::ROM(void* mapping, const size_t length)
+    : bytes(static_cast<const uint8_t*>(mapping)), length(length), mapping(mapping)
+{
+    hash = CalculateHash(bytes, length);
+}
+
+ROM::~ROM()
+{
+    if (mapping)
+        munmap(mapping, length);
+}
+
+std::shared_ptr<const ROM> LoadROM(const std::string& path)
+{
+    std::shared_ptr<const ROM> rom;
+    size_t length{};
+    if (auto mapping = MapFile(path, length); mapping)
+        rom.reset(new ROM(mapping, length));
+    else
+        rom = std::make_shared<ROM>(ReadFile(path));
+
+    std::lock_guard lock(cacheMutex);
+    const auto [first, last] = cache.equal_range(rom->GetHash());
+    for (auto it = first; it != last; ) {
+        if (auto existing = it->second.lock(); existing) {
+            if (existing->size() == rom->size() && memcmp(existing->data(), rom->data(), rom->size()) == 0)
+                return existing;
+            ++it;
+        } else {
+            it = cache.erase(it);
+        }
+    }
+    cache.emplace(rom->GetHash(), rom);
+    return rom;
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gb {
+
+// Cartridge ROM contents; these are immutable and can be shared by any
+// number of Cartridge instances. The bytes are either a read-only mapping
+// of the file or owned by the ROM itself
+class ROM
+{
+public:
+    explicit ROM(std::vector<uint8_t> contents);
+    ~ROM();
+
+    ROM(const ROM&) = delete;
+    ROM& operator=(const ROM&) = delete;
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    const uint8_t& operator[](const size_t offset) const { return bytes[offset]; }
+
+    // Hash of the contents, used to share identical ROMs
+    uint64_t GetHash() const { return hash; }
+
+private:
+    friend std::shared_ptr<const ROM> LoadROM(const std::string& path);
+    ROM(void* mapping, const size_t length);
+
+    const uint8_t* bytes{};
+    size_t length{};
+    uint64_t hash{};
+    void* mapping{};
+    std::vector<uint8_t> contents;
+};
+
+// Maps the file read-only, falling back to reading it in one go if that is
+// not possible. ROMs with identical contents that are still in use are
+// shared, so any number of machines running the same game (even when
+// loaded from different paths) only need a single copy
+std::shared_ptr<const ROM> LoadROM(const std::string& path);
+
+}
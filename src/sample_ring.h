@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace gb {
+
+// Lock-free single producer/single consumer ring of interleaved stereo
+// samples. One thread may only Push(), another only Pop()
+class SampleRing
+{
+public:
+    // The capacity is rounded up to a power of two
+    explicit SampleRing(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        buffer.resize(size);
+        mask = size - 1;
+    }
+
+    SampleRing(const SampleRing&) = delete;
+    SampleRing& operator=(const SampleRing&) = delete;
+
+    // Either stores all samples or none; the caller never waits for the
+    // consumer. Returns false if there was not enough room
+    bool Push(const int16_t* samples, const size_t count)
+    {
+        const auto head = writeIndex.load(std::memory_order_relaxed);
+        const auto tail = readIndex.load(std::memory_order_acquire);
+        if (buffer.size() - (head - tail) < count)
+            return false;
+        for (size_t n = 0; n < count; ++n)
+            buffer[(head + n) & mask] = samples[n];
+        writeIndex.store(head + count, std::memory_order_release);
+        return true;
+    }
+
+    // Returns the number of samples stored in samples[], at most count
+    size_t Pop(int16_t* samples, const size_t count)
+    {
+        const auto tail = readIndex.load(std::memory_order_relaxed);
+        const auto head = writeIndex.load(std::memory_order_acquire);
+        const auto available = std::min(count, head - tail);
+        for (size_t n = 0; n < available; ++n)
+            samples[n] = buffer[(tail + n) & mask];
+        readIndex.store(tail + available, std::memory_order_release);
+        return available;
+    }
+
+    size_t GetCapacity() const { return buffer.size(); }
+
+private:
+    std::vector<int16_t> buffer;
+    size_t mask{};
+    // Both indices only ever increase; they are reduced modulo the size on access
+    alignas(64) std::atomic<size_t> writeIndex{};
+    alignas(64) std::atomic<size_t> readIndex{};
+};
+
+}
@@ -0,0 +1,51 @@
+#include "save_file.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fmt/core.h"
+
+namespace gb {
+
+SaveFile::SaveFile(const std::string& path, const size_t size)
+{
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        throw std::runtime_error(fmt::format("unable to open '{}': {}", path, strerror(errno)));
+
+    // Files of other emulators may carry extra data (such as the clock)
+    // after the RAM, which is left alone
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (static_cast<size_t>(st.st_size) < size && ftruncate(fd, size) != 0)) {
+        const auto error = errno;
+        close(fd);
+        throw std::runtime_error(fmt::format("unable to resize '{}': {}", path, strerror(error)));
+    }
+    length = size;
+
+    void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const auto error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error(fmt::format("unable to map '{}': {}", path, strerror(error)));
+    bytes = static_cast<uint8_t*>(mapping);
+}
+
+SaveFile::~SaveFile()
+{
+    msync(bytes, length, MS_SYNC);
+    munmap(bytes, length);
+}
+
+void SaveFile::Flush()
+{
+    msync(bytes, length, MS_ASYNC);
+}
+
+}
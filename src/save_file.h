@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace gb {
+
+// Battery-backed RAM kept in a file: the file is mapped shared, so the
+// contents survive a crash of the emulator without writing on every
+// access. Flush() asks for the changes to be written back; destruction
+// waits until they are
+class SaveFile
+{
+public:
+    // Creates the file if needed and grows it to at least size bytes;
+    // existing contents are kept. Throws std::runtime_error on failure
+    SaveFile(const std::string& path, const size_t size);
+    ~SaveFile();
+
+    SaveFile(const SaveFile&) = delete;
+    SaveFile& operator=(const SaveFile&) = delete;
+
+    uint8_t* data() { return bytes; }
+    size_t size() const { return length; }
+
+    // Does not block
+    void Flush();
+
+private:
+    uint8_t* bytes{};
+    size_t length{};
+};
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace gb {
+    using Cycle = uint64_t;
+
+    namespace event {
+        enum Type {
+            Video,
+            Audio,
+            Timer,
+            Serial,
+            NumberOfTypes
+        };
+    }
+
+    // Keeps the global clock and, per device, the cycle at which it next
+    // needs to run. The CPU only has to compare the clock against
+    // nextEvent after every instruction
+    struct Scheduler {
+        static constexpr Cycle Never = std::numeric_limits<Cycle>::max();
+
+        Scheduler()
+        {
+            deadline.fill(Never);
+        }
+
+        void Schedule(const event::Type type, const Cycle cycle)
+        {
+            deadline[type] = cycle;
+            nextEvent = *std::min_element(deadline.begin(), deadline.end());
+        }
+
+        void Cancel(const event::Type type)
+        {
+            Schedule(type, Never);
+        }
+
+        bool IsDue(const event::Type type) const
+        {
+            return deadline[type] <= now;
+        }
+
+        Cycle now{};
+        Cycle nextEvent{Never};
+        std::array<Cycle, event::NumberOfTypes> deadline;
+    };
+}
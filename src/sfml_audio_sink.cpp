@@ -0,0 +1,39 @@
+#include "sfml_audio_sink.h"
+#include "audio.h"
+#include <algorithm>
+
+namespace gb {
+
+namespace {
+    constexpr unsigned int numChannels = 2;
+    // About 85ms; samples arriving while the ring is full are dropped
+    constexpr size_t ringSize = 8192;
+}
+
+SFMLAudioSink::SFMLAudioSink()
+    : ring(ringSize)
+{
+    initialize(numChannels, Audio::SampleRate);
+    play();
+}
+
+SFMLAudioSink::~SFMLAudioSink()
+{
+    stop();
+}
+
+void SFMLAudioSink::Write(const int16_t* samples, const size_t count)
+{
+    ring.Push(samples, count);
+}
+
+bool SFMLAudioSink::onGetData(Chunk& data)
+{
+    const auto count = ring.Pop(chunk.data(), chunk.size());
+    std::fill(chunk.begin() + count, chunk.end(), 0);
+    data.samples = chunk.data();
+    data.sampleCount = chunk.size();
+    return true;
+}
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <SFML/Audio/SoundStream.hpp>
+#include "audio_sink.h"
+#include "sample_ring.h"
+
+namespace gb {
+
+// Plays the audio live. SFML pulls the samples from its own thread; when
+// the emulator falls behind, silence is played instead
+class SFMLAudioSink : public AudioSink, private sf::SoundStream
+{
+public:
+    SFMLAudioSink();
+    ~SFMLAudioSink() override;
+
+    void Write(const int16_t* samples, const size_t count) override;
+
+private:
+    bool onGetData(Chunk& data) override;
+    void onSeek(sf::Time) override { }
+
+    SampleRing ring;
+    std::array<int16_t, 2048> chunk{};
+};
+
+}
@@ -0,0 +1,111 @@
+#include "state.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+namespace gb::state {
+
+namespace {
+    bool IsZero(const uint8_t* bytes, const size_t length)
+    {
+        uint64_t any = 0;
+        for (size_t n = 0; n + sizeof(uint64_t) <= length; n += sizeof(uint64_t)) {
+            uint64_t v;
+            memcpy(&v, &bytes[n], sizeof(v));
+            any |= v;
+        }
+        for (size_t n = length & ~(sizeof(uint64_t) - 1); n < length; ++n)
+            any |= bytes[n];
+        return any == 0;
+    }
+
+    constexpr size_t GetNumberOfBlocks(const size_t length)
+    {
+        return (length + BlockSize - 1) / BlockSize;
+    }
+}
+
+void Writer::Write(const std::string& value)
+{
+    Write(static_cast<uint32_t>(value.size()));
+    WriteBytes(value.data(), value.size());
+}
+
+void Writer::WriteBytes(const void* bytes, const size_t length)
+{
+    const auto p = static_cast<const uint8_t*>(bytes);
+    data.insert(data.end(), p, p + length);
+}
+
+void Writer::WriteRegion(const uint8_t* bytes, const size_t length)
+{
+    if (!storeRegions) return;
+    const auto numberOfBlocks = GetNumberOfBlocks(length);
+    const auto maskOffset = data.size();
+    data.resize(data.size() + (numberOfBlocks + 7) / 8);
+    for (size_t block = 0; block < numberOfBlocks; ++block) {
+        const auto start = block * BlockSize;
+        const auto size = std::min(BlockSize, length - start);
+        if (IsZero(&bytes[start], size)) continue;
+        data[maskOffset + block / 8] |= 1 << (block % 8);
+        WriteBytes(&bytes[start], size);
+    }
+}
+
+const uint8_t* Reader::Consume(const size_t n)
+{
+    if (length - offset < n)
+        throw std::runtime_error("state truncated");
+    const auto p = &data[offset];
+    offset += n;
+    return p;
+}
+
+void Reader::Read(std::string& value)
+{
+    const auto size = Read<uint32_t>();
+    const auto p = Consume(size);
+    value.assign(reinterpret_cast<const char*>(p), size);
+}
+
+void Reader::ReadBytes(void* bytes, const size_t length)
+{
+    memcpy(bytes, Consume(length), length);
+}
+
+void Reader::ReadRegion(uint8_t* bytes, const size_t length)
+{
+    if (skipRegions) return;
+    const auto numberOfBlocks = GetNumberOfBlocks(length);
+    const auto mask = Consume((numberOfBlocks + 7) / 8);
+    for (size_t block = 0; block < numberOfBlocks; ++block) {
+        const auto start = block * BlockSize;
+        const auto size = std::min(BlockSize, length - start);
+        if (mask[block / 8] & (1 << (block % 8)))
+            memcpy(&bytes[start], Consume(size), size);
+        else
+            memset(&bytes[start], 0, size);
+    }
+}
+
+void Save(const std::string& path, const std::vector<uint8_t>& state)
+{
+    std::ofstream ofs(path, std::ios::binary);
+    ofs.write(reinterpret_cast<const char*>(state.data()), state.size());
+    if (!ofs)
+        throw std::runtime_error("write error");
+}
+
+std::vector<uint8_t> Load(const std::string& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+        throw std::runtime_error("unable to open file");
+    std::vector<uint8_t> state(std::istreambuf_iterator<char>(ifs), {});
+    if (ifs.bad())
+        throw std::runtime_error("read error");
+    return state;
+}
+
+}
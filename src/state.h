@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace gb::state {
+    // Bumped whenever the layout of any device's state changes; snapshots
+    // of a different version are rejected
+    inline constexpr uint32_t Version = 7;
+
+    // Large regions (RAM, the framebuffer) are split into blocks of this
+    // size; blocks that are entirely zero are not stored
+    inline constexpr size_t BlockSize = 256;
+
+    // Appends the state of the devices to a snapshot. Values are stored
+    // as-is, in host byte order
+    class Writer
+    {
+    public:
+        // The contents of data are replaced; reusing the same vector avoids
+        // reallocating for every snapshot. Without storeRegions, regions
+        // are left out entirely
+        explicit Writer(std::vector<uint8_t>& data, const bool storeRegions = true)
+            : data(data), storeRegions(storeRegions)
+        {
+            data.clear();
+        }
+
+        template<typename T>
+        void Write(const T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            WriteBytes(&value, sizeof(value));
+        }
+
+        void Write(const std::string& value);
+        void WriteBytes(const void* bytes, const size_t length);
+        // Stores a bitmask of the non-zero blocks followed by their contents
+        void WriteRegion(const uint8_t* bytes, const size_t length);
+
+    private:
+        std::vector<uint8_t>& data;
+        const bool storeRegions;
+    };
+
+    // Reads back a snapshot made by Writer, in the same order; running out
+    // of data throws std::runtime_error
+    class Reader
+    {
+    public:
+        Reader(const uint8_t* data, const size_t length) : data(data), length(length) { }
+        explicit Reader(const std::vector<uint8_t>& data) : Reader(data.data(), data.size()) { }
+
+        template<typename T>
+        void Read(T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            ReadBytes(&value, sizeof(value));
+        }
+
+        template<typename T>
+        T Read()
+        {
+            T value;
+            Read(value);
+            return value;
+        }
+
+        void Read(std::string& value);
+        void ReadBytes(void* bytes, const size_t length);
+        void ReadRegion(uint8_t* bytes, const size_t length);
+        bool AtEnd() const { return offset == length; }
+        // For snapshots without regions: ReadRegion() leaves them as they are
+        void SkipRegions(const bool skip) { skipRegions = skip; }
+
+    private:
+        const uint8_t* Consume(const size_t n);
+
+        const uint8_t* data;
+        size_t length;
+        size_t offset{};
+        bool skipRegions{};
+    };
+
+    void Save(const std::string& path, const std::vector<uint8_t>& state);
+    std::vector<uint8_t> Load(const std::string& path);
+}
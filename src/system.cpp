@@ -0,0 +1,274 @@
+#include "system.h"
+#include "cpu.h"
+#include "interpreter.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace gb {
+    namespace {
+        // Layout: the magic, the version (uint32_t), the hash of the ROM
+        // (uint64_t) and whether regions are stored (bool), followed by the
+        // state of the CPU and every device
+        constexpr char stateMagic[8] = { 'G', 'B', 'S', 'T', 'A', 'T', 'E', 0 };
+    }
+
+    void System::Reset(const bool bootROM)
+    {
+        regs = cpu::Registers{};
+        if (!bootROM) {
+            // From https://gbdev.gg8.se/wiki/articles/Power_Up_Sequence
+            regs.a = 0x01; regs.fl = 0xb0;
+            regs.b = 0x00; regs.c = 0x13;
+            regs.d = 0x00; regs.e = 0xd8;
+            regs.h = 0x01; regs.l = 0x4d;
+            regs.pc = 0x100;
+            // The bootstrap ROM unmaps itself as its final action
+            io.Register(io::DMG) = 1;
+        } else {
+            regs.pc = 0x0;
+            io.Register(io::DMG) = 0;
+        }
+        regs.sp = 0xfffe;
+        memory.MapCartridge();
+    }
+
+    int System::Step()
+    {
+        const auto* instruction = &cpu::opcode[0x00]; // NOP
+        const Address pc = regs.pc;
+        uint8_t opcode = 0x00;
+        bool executing = false, prefixed = false;
+        if (regs.stop) {
+            if (io.buttonPressed != 0)
+                regs.stop = false;
+        } else if (!regs.halt) {
+            if (trace)
+                TraceInstruction(regs);
+            executing = true;
+            opcode = cpu::detail::ReadAndAdvancePC_u8(regs, memory);
+
+            if (opcode != 0xcb) {
+                instruction = &cpu::opcode[opcode];
+            } else {
+                prefixed = true;
+                opcode = cpu::detail::ReadAndAdvancePC_u8(regs, memory);
+                instruction = &cpu::opcode_cb[opcode];
+            }
+        }
+
+        const int numClocks = instruction->func(regs, memory);
+        if (executionProfile && executing)
+            executionProfile->Record(pc, opcode, prefixed, numClocks, regs.pc);
+
+        scheduler.now += numClocks;
+        if (scheduler.now >= scheduler.nextEvent)
+            DispatchEvents();
+
+        if (io.IsIRQPending())
+            DispatchIRQ(regs);
+        return numClocks;
+    }
+
+    int System::Run(const int cycles)
+    {
+        if (regs.halt || regs.stop)
+            return Idle(cycles);
+
+        // Keep the registers in a local so the compiler is free to hold
+        // them in host registers for the whole block
+        auto r = regs;
+        int numClocks = 0;
+        const auto advance = [&](const int n) {
+            numClocks += n;
+            scheduler.now += n;
+            if (io.IsIRQPending())
+                DispatchIRQ(r);
+        };
+        const auto keepRunning = [&]() {
+            return numClocks < cycles && scheduler.now < scheduler.nextEvent && !r.halt && !r.stop;
+        };
+        do {
+            const auto block = blockCache.Lookup(r.pc);
+            if (!block) {
+                if (trace)
+                    TraceInstruction(r);
+                if (!executionProfile) {
+                    advance(cpu::Execute(r, memory));
+                    continue;
+                }
+                // The opcode has to be read before it executes, as it
+                // may overwrite itself
+                const Address pc = r.pc;
+                const bool prefixed = memory.At_u8(pc) == 0xcb;
+                const auto opcode = memory.At_u8(prefixed ? pc + 1 : pc);
+                const int n = cpu::Execute(r, memory);
+                executionProfile->Record(pc, opcode, prefixed, n, r.pc);
+                advance(n);
+                continue;
+            }
+
+            // Leave the block as soon as the flow of control changes (an
+            // interrupt) or its code may have been modified
+            const auto generation = memory.codeGeneration;
+            for(const auto& instruction: block->instructions) {
+                const Address next = r.pc + instruction.length;
+                if (trace)
+                    TraceInstruction(r);
+                const Address pc = r.pc;
+                int n;
+                if (instruction.prefixed) {
+                    r.pc += 2;
+                    n = cpu::DispatchCB(instruction.opcode, r, memory);
+                } else if (instruction.length == 1) {
+                    r.pc += 1;
+                    n = cpu::Dispatch(instruction.opcode, r, memory);
+                } else {
+                    r.pc += 1;
+                    n = cpu::DispatchImmediate(instruction.opcode, instruction.operand, r, memory);
+                }
+                // Before advancing, which may dispatch an interrupt
+                if (executionProfile)
+                    executionProfile->Record(pc, instruction.opcode, instruction.prefixed, n, r.pc);
+                advance(n);
+                if (r.pc != next || memory.codeGeneration != generation || !keepRunning())
+                    break;
+            }
+        } while (keepRunning());
+        regs = r;
+
+        if (scheduler.now >= scheduler.nextEvent) {
+            DispatchEvents();
+            if (io.IsIRQPending())
+                DispatchIRQ(regs);
+        }
+        return numClocks;
+    }
+
+    // Only events raise interrupts, and the buttons do not change during
+    // a call, so nothing can wake the CPU before the next event. The clock
+    // advances in whole NOPs, just as if they were executed one by one
+    int System::Idle(const int cycles)
+    {
+        if (regs.stop && io.buttonPressed != 0)
+            return Step();
+
+        Cycle n = cycles > 0 ? cycles : 0;
+        if (scheduler.nextEvent > scheduler.now)
+            n = std::min(n, scheduler.nextEvent - scheduler.now);
+        n = std::max<Cycle>(4, (n + 3) & ~Cycle{3});
+
+        scheduler.now += n;
+        if (scheduler.now >= scheduler.nextEvent)
+            DispatchEvents();
+        if (io.IsIRQPending())
+            DispatchIRQ(regs);
+        return static_cast<int>(n);
+    }
+
+    void System::SetProfiler(Profiler* p)
+    {
+        profiler = p;
+        video.SetProfiler(p);
+        io.profiler = p;
+        audio.SetProfiler(p);
+    }
+
+    void System::SetExecutionProfile(ExecutionProfile* profile)
+    {
+        executionProfile = profile;
+    }
+
+    void System::SetTrace(trace::Buffer* buffer, const bool traceMemory)
+    {
+        trace = buffer;
+        memory.SetTrace(traceMemory ? buffer : nullptr);
+    }
+
+    void System::SaveState(std::vector<uint8_t>& snapshot, const bool storeMemory)
+    {
+        state::Writer writer(snapshot, storeMemory);
+        writer.Write(stateMagic);
+        writer.Write(state::Version);
+        writer.Write(cartridge.GetROM().GetHash());
+        writer.Write(storeMemory);
+        writer.Write(regs);
+        writer.Write(scheduler.now);
+        writer.Write(scheduler.deadline);
+        cartridge.SaveState(writer);
+        io.SaveState(writer);
+        memory.SaveState(writer);
+        video.SaveState(writer);
+        audio.SaveState(writer);
+    }
+
+    std::vector<uint8_t> System::SaveState()
+    {
+        std::vector<uint8_t> snapshot;
+        SaveState(snapshot);
+        return snapshot;
+    }
+
+    void System::LoadState(const std::vector<uint8_t>& snapshot)
+    {
+        state::Reader reader(snapshot);
+        char magic[sizeof(stateMagic)];
+        reader.Read(magic);
+        if (memcmp(magic, stateMagic, sizeof(magic)) != 0)
+            throw std::runtime_error("not a state snapshot");
+        if (reader.Read<uint32_t>() != state::Version)
+            throw std::runtime_error("unsupported state version");
+        if (reader.Read<uint64_t>() != cartridge.GetROM().GetHash())
+            throw std::runtime_error("state belongs to a different cartridge");
+        reader.SkipRegions(!reader.Read<bool>());
+
+        reader.Read(regs);
+        reader.Read(scheduler.now);
+        auto deadline = scheduler.deadline;
+        reader.Read(deadline);
+        for(int type = 0; type < event::NumberOfTypes; ++type)
+            scheduler.Schedule(static_cast<event::Type>(type), deadline[type]);
+        cartridge.LoadState(reader);
+        io.LoadState(reader);
+        memory.LoadState(reader);
+        video.LoadState(reader);
+        audio.LoadState(reader);
+        blockCache.Clear();
+        tileCache.Clear();
+        if (!reader.AtEnd())
+            throw std::runtime_error("unexpected data after state");
+    }
+
+    void System::TraceInstruction(const cpu::Registers& r)
+    {
+        constexpr size_t InvalidInstructionContext = 32;
+        const uint8_t bytes[3] = { memory.At_u8(r.pc), memory.At_u8(r.pc + 1), memory.At_u8(r.pc + 2) };
+        trace->RecordInstruction(scheduler.now, r, bytes);
+        if (cpu::IsInvalidOpcode(bytes[0]))
+            trace->Dump(std::cerr, InvalidInstructionContext);
+    }
+
+    void System::DispatchEvents()
+    {
+        if (scheduler.IsDue(event::Video))
+            video.Sync();
+        if (scheduler.IsDue(event::Audio))
+            audio.Sync();
+        if (scheduler.IsDue(event::Timer))
+            io.SyncTimer();
+        if (scheduler.IsDue(event::Serial))
+            io.SyncSerial();
+    }
+
+    void System::DispatchIRQ(cpu::Registers& r)
+    {
+        const auto pendingIrq = io.GetPendingIRQ();
+        r.halt = false;
+        if (r.ime) {
+            io.ClearPendingIRQ(*pendingIrq);
+            cpu::InvokeIRQ(r, memory, *pendingIrq);
+            if (executionProfile)
+                executionProfile->EnterInterrupt(r.pc);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "audio.h"
+#include "block_cache.h"
+#include "cartridge.h"
+#include "execution_profile.h"
+#include "io.h"
+#include "memory.h"
+#include "profiler.h"
+#include "registers.h"
+#include "scheduler.h"
+#include "tile_cache.h"
+#include "state.h"
+#include "trace.h"
+#include "video.h"
+
+namespace gb {
+    // A complete, self-contained machine: the CPU, all devices and the
+    // cartridge. Independent instances may run on different threads; only
+    // the (immutable) ROM contents are shared
+    struct System {
+        static constexpr int CyclesPerFrame = 154 * 456;
+
+        explicit System(std::shared_ptr<const ROM> rom) : cartridge(scheduler, std::move(rom))
+        {
+            memory.blockCache = &blockCache;
+            memory.tileCache = &tileCache;
+        }
+
+        void Reset(const bool bootROM);
+
+        // Executes a single instruction (or idles while halted/stopped),
+        // advances all devices and dispatches pending interrupts. Returns
+        // the number of clock cycles spent
+        int Step();
+
+        // Executes instructions until at least the given number of cycles
+        // has passed, a device needs to run or the CPU halts. This is the
+        // fast path, running pre-decoded blocks where possible. Returns the
+        // number of clock cycles spent. While the CPU is halted or stopped,
+        // the clock skips ahead to the next event instead
+        int Run(const int cycles);
+
+        // Accounts the time spent per subsystem to the profiler; nullptr
+        // disables profiling
+        void SetProfiler(Profiler* profiler);
+
+        // Counts the instructions executed, and their cycles, per opcode
+        // and address; nullptr stops counting
+        void SetExecutionProfile(ExecutionProfile* profile);
+
+        // Records every instruction (and, if traceMemory is set, every
+        // memory access) in the trace buffer; nullptr disables tracing.
+        // Executing an invalid opcode dumps the most recent instructions
+        void SetTrace(trace::Buffer* buffer, const bool traceMemory);
+
+        // Stores the complete machine state, except for the ROM contents,
+        // in a versioned snapshot; the contents of snapshot are replaced.
+        // Without storeMemory, RAM, external RAM and the framebuffer are
+        // left out, and keep their contents when the snapshot is loaded
+        void SaveState(std::vector<uint8_t>& snapshot, const bool storeMemory = true);
+        std::vector<uint8_t> SaveState();
+        // Restores a snapshot made by SaveState() on a machine running the
+        // same ROM. A snapshot of another version or ROM throws
+        // std::runtime_error without touching the machine; a truncated one
+        // leaves it in an undefined state
+        void LoadState(const std::vector<uint8_t>& snapshot);
+
+        Scheduler scheduler;
+        Cartridge cartridge;
+        Video video{scheduler, io, memory, tileCache};
+        Audio audio{scheduler};
+        IO io{scheduler, video, audio};
+        Memory memory{scheduler, io, cartridge};
+        BlockCache blockCache{memory};
+        TileCache tileCache{memory};
+        cpu::Registers regs;
+
+    private:
+        int Idle(const int cycles);
+        void TraceInstruction(const cpu::Registers& r);
+        void DispatchEvents();
+        void DispatchIRQ(cpu::Registers& r);
+
+        Profiler* profiler{};
+        ExecutionProfile* executionProfile{};
+        trace::Buffer* trace{};
+    };
+}
@@ -0,0 +1,59 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+namespace gb {
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+{
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    for(unsigned int n = 0; n < numThreads; ++n)
+        threads.emplace_back([this]() { Worker(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(mutex);
+        terminating = true;
+    }
+    jobAvailable.notify_all();
+    for(auto& thread: threads)
+        thread.join();
+}
+
+void ThreadPool::Submit(Job job)
+{
+    {
+        std::lock_guard lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    jobAvailable.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    std::unique_lock lock(mutex);
+    jobsDone.wait(lock, [this]() { return jobs.empty() && jobsRunning == 0; });
+}
+
+void ThreadPool::Worker()
+{
+    std::unique_lock lock(mutex);
+    while(true) {
+        jobAvailable.wait(lock, [this]() { return terminating || !jobs.empty(); });
+        if (jobs.empty())
+            return; // terminating
+
+        auto job = std::move(jobs.front());
+        jobs.pop_front();
+        ++jobsRunning;
+        lock.unlock();
+        job();
+        lock.lock();
+        if (--jobsRunning == 0 && jobs.empty())
+            jobsDone.notify_all();
+    }
+}
+
+}
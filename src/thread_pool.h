@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gb {
+
+// Fixed set of worker threads processing submitted jobs in FIFO order
+class ThreadPool
+{
+public:
+    using Job = std::function<void()>;
+
+    // numThreads == 0 uses one thread per hardware thread
+    explicit ThreadPool(unsigned int numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(Job job);
+    // Blocks until all submitted jobs have completed
+    void Wait();
+
+    size_t GetNumberOfThreads() const { return threads.size(); }
+
+private:
+    void Worker();
+
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobsDone;
+    std::deque<Job> jobs;
+    size_t jobsRunning{};
+    bool terminating{};
+    std::vector<std::thread> threads;
+};
+
+}
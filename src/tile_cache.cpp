@@ -0,0 +1,58 @@
+#include "tile_cache.h"
+
+namespace gb {
+
+namespace {
+    // Spreads the 8 pixels of a tile row byte over the bytes of a uint64_t,
+    // the leftmost pixel (bit 7, or bit 0 when flipped) in the lowest byte
+    template<bool Flipped>
+    constexpr std::array<uint64_t, 256> MakeTileRowTable()
+    {
+        std::array<uint64_t, 256> table{};
+        for (int v = 0; v < 256; ++v) {
+            for (int pixel = 0; pixel < 8; ++pixel) {
+                const int bit = Flipped ? pixel : 7 - pixel;
+                if (v & (1 << bit))
+                    table[v] |= uint64_t{1} << (pixel * 8);
+            }
+        }
+        return table;
+    }
+
+    constexpr auto tileRow = MakeTileRowTable<false>();
+    constexpr auto tileRowFlipped = MakeTileRowTable<true>();
+
+    constexpr int TilesPerPage = (Memory::PageMask + 1) / 16;
+}
+
+TileCache::TileCache(Memory& memory)
+    : memory(memory)
+{
+}
+
+void TileCache::Decode(const int tile)
+{
+    const Address base = TileDataStart + tile * 16;
+    for (int row = 0; row < 8; ++row) {
+        // The first byte of a row supplies the high bit of every colour number
+        const auto b1 = memory.data[base + row * 2];
+        const auto b2 = memory.data[base + row * 2 + 1];
+        rows[tile][row] = (tileRow[b1] << 1) | tileRow[b2];
+        flippedRows[tile][row] = (tileRowFlipped[b1] << 1) | tileRowFlipped[b2];
+    }
+    decoded[tile] = true;
+    memory.TrackTiles(base);
+}
+
+void TileCache::InvalidatePage(const Address base)
+{
+    const auto first = (base - TileDataStart) / 16;
+    std::fill(&decoded[first], &decoded[first] + TilesPerPage, false);
+}
+
+void TileCache::Clear()
+{
+    decoded.fill(false);
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "memory.h"
+#include "types.h"
+
+namespace gb {
+
+// Tile data in VRAM (0x8000..0x97ff), decoded to colour numbers. A row is
+// stored as a uint64_t holding the colour number of every pixel in a byte,
+// the leftmost pixel in the lowest one. Tiles are decoded when first used;
+// Memory traps writes to the pages they came from and then drops them
+// through InvalidatePage()
+class TileCache
+{
+public:
+    static constexpr int NumberOfTiles = 384;
+    static constexpr Address TileDataStart = 0x8000;
+    static constexpr Address TileDataEnd = 0x97ff;
+
+    explicit TileCache(Memory& memory);
+
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    // The row starting at address, which must be within the tile data;
+    // Flipped mirrors it horizontally
+    template<bool Flipped = false>
+    uint64_t GetRow(const Address address)
+    {
+        const auto tile = (address - TileDataStart) >> 4;
+        if (!decoded[tile])
+            Decode(tile);
+        return (Flipped ? flippedRows : rows)[tile][(address >> 1) & 7];
+    }
+
+    // Drops all tiles decoded from the page of memory.data at base
+    void InvalidatePage(const Address base);
+    void Clear();
+
+private:
+    void Decode(const int tile);
+
+    Memory& memory;
+    std::array<bool, NumberOfTiles> decoded{};
+    std::array<std::array<uint64_t, 8>, NumberOfTiles> rows{};
+    std::array<std::array<uint64_t, 8>, NumberOfTiles> flippedRows{};
+};
+
+}
@@ -0,0 +1,123 @@
+#include "trace.h"
+#include "disassembler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+
+#include "fmt/core.h"
+
+namespace gb::trace {
+
+namespace {
+    std::string AddressToString(const Address address)
+    {
+        if ((address >= memory_map::IOStart && address <= memory_map::IOEnd) || address == memory_map::IE)
+            return fmt::format("{:04x} ({})", address, disassembler::IORegisterToString(address));
+        return fmt::format("{:04x}", address);
+    }
+
+    // File layout: the magic, the record size (uint32_t) and the records,
+    // all in host byte order
+    constexpr char magic[8] = { 'G', 'B', 'T', 'R', 'A', 'C', 'E', '1' };
+}
+
+cpu::Registers GetRegisters(const Record& record)
+{
+    cpu::Registers regs;
+    regs.pc = record.address;
+    regs.sp = record.sp;
+    regs.a = record.a; regs.fl = record.fl;
+    regs.b = record.b; regs.c = record.c;
+    regs.d = record.d; regs.e = record.e;
+    regs.h = record.h; regs.l = record.l;
+    regs.ime = (record.flags & RecordIME) != 0;
+    regs.halt = (record.flags & RecordHalt) != 0;
+    return regs;
+}
+
+std::string ToString(const Record& record)
+{
+    switch(record.type) {
+        case RecordType::Instruction:
+            return fmt::format("{:12} {} {}", record.cycle,
+                disassembler::RegistersToString(GetRegisters(record)),
+                disassembler::Disassemble(record.address, record.bytes));
+        case RecordType::MemoryRead:
+            return fmt::format("{:12}   read  {} -> {:02x}", record.cycle, AddressToString(record.address), record.value);
+        case RecordType::MemoryWrite:
+            return fmt::format("{:12}   write {} <- {:02x}", record.cycle, AddressToString(record.address), record.value);
+    }
+    return fmt::format("{:12} <unknown record type {}>", record.cycle, static_cast<int>(record.type));
+}
+
+Buffer::Buffer(const size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    records.resize(size);
+    mask = size - 1;
+}
+
+std::vector<Record> Buffer::GetRecords(const size_t maxCount) const
+{
+    const auto numRecords = std::min<uint64_t>({ count, records.size(), maxCount });
+    std::vector<Record> result;
+    result.reserve(numRecords);
+    for (auto n = count - numRecords; n < count; ++n)
+        result.push_back(records[n & mask]);
+    return result;
+}
+
+void Buffer::Dump(std::ostream& os, const size_t numberOfInstructions) const
+{
+    // Walk back until enough instructions have been seen
+    const auto available = std::min<uint64_t>(count, records.size());
+    uint64_t numRecords = 0;
+    size_t numInstructions = 0;
+    while (numRecords < available && numInstructions < numberOfInstructions) {
+        ++numRecords;
+        if (records[(count - numRecords) & mask].type == RecordType::Instruction)
+            ++numInstructions;
+    }
+
+    os << fmt::format("last {} instructions:\n", numInstructions);
+    for (const auto& record: GetRecords(numRecords))
+        os << ToString(record) << "\n";
+}
+
+void Buffer::Save(const std::string& path) const
+{
+    std::ofstream ofs(path, std::ios::binary);
+    const uint32_t recordSize = sizeof(Record);
+    ofs.write(magic, sizeof(magic));
+    ofs.write(reinterpret_cast<const char*>(&recordSize), sizeof(recordSize));
+    const auto result = GetRecords();
+    ofs.write(reinterpret_cast<const char*>(result.data()), result.size() * sizeof(Record));
+    if (!ofs)
+        throw std::runtime_error("cannot write '" + path + "'");
+}
+
+std::vector<Record> Buffer::Load(const std::string& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+        throw std::runtime_error("cannot open '" + path + "'");
+
+    char fileMagic[sizeof(magic)];
+    uint32_t recordSize{};
+    ifs.read(fileMagic, sizeof(fileMagic));
+    ifs.read(reinterpret_cast<char*>(&recordSize), sizeof(recordSize));
+    if (!ifs || memcmp(fileMagic, magic, sizeof(magic)) != 0 || recordSize != sizeof(Record))
+        throw std::runtime_error("'" + path + "' is not a trace file");
+
+    std::vector<Record> result;
+    Record record;
+    while (ifs.read(reinterpret_cast<char*>(&record), sizeof(record)))
+        result.push_back(record);
+    return result;
+}
+
+}
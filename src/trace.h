@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "registers.h"
+#include "scheduler.h"
+#include "types.h"
+
+namespace gb::trace {
+    enum class RecordType : uint8_t {
+        Instruction,
+        MemoryRead,
+        MemoryWrite
+    };
+
+    // Fixed-size binary trace entry. An instruction record holds the state
+    // before the instruction executes; memory accesses share the cycle
+    // stamp of the instruction performing them
+    struct Record {
+        Cycle cycle;
+        RecordType type;
+        uint8_t value;      // memory accesses: the byte read or written
+        Address address;    // instructions: pc, memory accesses: the address
+        Address sp;
+        uint8_t a, fl, b, c, d, e, h, l;
+        uint8_t bytes[3];   // the instruction, including its immediates
+        uint8_t flags;      // ime/halt, see Record{IME,Halt}
+        uint8_t reserved[6];
+    };
+    static_assert(sizeof(Record) == 32, "records are stored as-is");
+
+    inline constexpr uint8_t RecordIME = (1 << 0);
+    inline constexpr uint8_t RecordHalt = (1 << 1);
+
+    cpu::Registers GetRegisters(const Record& record);
+    std::string ToString(const Record& record);
+
+    // Preallocated ring holding the most recent records; once it is full,
+    // the oldest records are overwritten. Storing a record is a handful
+    // of stores, so tracing can stay enabled
+    class Buffer
+    {
+    public:
+        static constexpr size_t DefaultCapacity = 1 << 20;
+
+        // The capacity is rounded up to a power of two
+        explicit Buffer(const size_t capacity = DefaultCapacity);
+
+        // bytes[] must hold the three bytes starting at regs.pc
+        void RecordInstruction(const Cycle cycle, const cpu::Registers& regs, const uint8_t* bytes)
+        {
+            auto& r = Next();
+            r.cycle = cycle;
+            r.type = RecordType::Instruction;
+            r.value = 0;
+            r.address = regs.pc;
+            r.sp = regs.sp;
+            r.a = regs.a; r.fl = regs.fl;
+            r.b = regs.b; r.c = regs.c;
+            r.d = regs.d; r.e = regs.e;
+            r.h = regs.h; r.l = regs.l;
+            r.bytes[0] = bytes[0]; r.bytes[1] = bytes[1]; r.bytes[2] = bytes[2];
+            r.flags = (regs.ime ? RecordIME : 0) | (regs.halt ? RecordHalt : 0);
+            currentCycle = cycle;
+        }
+
+        void RecordMemoryAccess(const RecordType type, const Address address, const uint8_t value)
+        {
+            auto& r = Next();
+            r = Record{};
+            r.cycle = currentCycle;
+            r.type = type;
+            r.address = address;
+            r.value = value;
+        }
+
+        // The most recent records (at most maxCount), oldest first
+        std::vector<Record> GetRecords(const size_t maxCount = SIZE_MAX) const;
+        // Forgets all records, i.e. to only look at those of the next step
+        void Clear() { count = 0; }
+        // Writes the last numberOfInstructions instructions, with their
+        // memory accesses, in human readable form
+        void Dump(std::ostream& os, const size_t numberOfInstructions) const;
+        void Save(const std::string& path) const;
+        static std::vector<Record> Load(const std::string& path);
+
+    private:
+        Record& Next()
+        {
+            return records[count++ & mask];
+        }
+
+        std::vector<Record> records;
+        size_t mask{};
+        uint64_t count{};
+        Cycle currentCycle{};
+    };
+}
@@ -0,0 +1,72 @@
+#include "trace.h"
+
+#include <iostream>
+#include <unistd.h>
+
+#include "fmt/core.h"
+
+namespace {
+
+size_t optionLast = 0;
+bool optionInstructionsOnly = false;
+std::string tracePath;
+
+bool ProcessOptions(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "h?in:")) != -1) {
+        switch(opt) {
+            case 'h':
+            case '?':
+                std::cout << fmt::format("usage: {} [-h?i] [-n count] file.trace\n\n", argv[0]);
+                std::cout << fmt::format("  -h, -?     this help\n");
+                std::cout << fmt::format("  -i         only show instructions, no memory accesses\n");
+                std::cout << fmt::format("  -n count   only show the last count records\n");
+                return false;
+            case 'i':
+                optionInstructionsOnly = true;
+                break;
+            case 'n':
+                optionLast = std::stoul(optarg);
+                break;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cout << fmt::format("expected file.trace after options\n");
+        return false;
+    }
+    tracePath = argv[optind];
+    return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    if (!ProcessOptions(argc, argv)) return 1;
+
+    std::vector<gb::trace::Record> records;
+    try {
+        records = gb::trace::Buffer::Load(tracePath);
+    } catch (std::exception& e) {
+        std::cout << fmt::format("{}\n", e.what());
+        return 1;
+    }
+
+    if (optionInstructionsOnly) {
+        std::vector<gb::trace::Record> instructions;
+        for(const auto& record: records) {
+            if (record.type == gb::trace::RecordType::Instruction)
+                instructions.push_back(record);
+        }
+        records = std::move(instructions);
+    }
+
+    size_t first = 0;
+    if (optionLast > 0 && records.size() > optionLast)
+        first = records.size() - optionLast;
+    for(size_t n = first; n < records.size(); ++n)
+        std::cout << gb::trace::ToString(records[n]) << "\n";
+    return 0;
+}
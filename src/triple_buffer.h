@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+namespace gb {
+
+// Lock-free handoff of the latest value from a producer thread to a
+// consumer thread. Each side owns one of three slots and the third is
+// exchanged between them, so neither ever waits for the other; values the
+// consumer did not pick up in time are overwritten
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Producer: the slot to fill in, which Publish() then hands over
+    T& GetBack() { return slots[back]; }
+    void Publish()
+    {
+        back = middle.exchange(back | Fresh, std::memory_order_acq_rel) & IndexMask;
+    }
+
+    // Consumer: the most recently published value, or nullptr if nothing
+    // was published since the last call. It stays valid until the next call
+    const T* Consume()
+    {
+        if ((middle.load(std::memory_order_relaxed) & Fresh) == 0)
+            return nullptr;
+        front = middle.exchange(front, std::memory_order_acq_rel) & IndexMask;
+        return &slots[front];
+    }
+
+private:
+    static constexpr int IndexMask = 3;
+    static constexpr int Fresh = 4;
+
+    std::array<T, 3> slots{};
+    alignas(64) int back{0};
+    alignas(64) std::atomic<int> middle{1};
+    alignas(64) int front{2};
+};
+
+}
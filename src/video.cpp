@@ -1,27 +1,17 @@
 #include "video.h"
+#include <algorithm>
 #include <array>
-#include <chrono>
-#include <thread>
 #include <vector>
 
-#include "gui.h"
 #include "memory.h"
 #include "io.h"
-
-#include "imgui.h"
-#include "imgui-SFML.h"
-
-#include <SFML/Graphics/RenderWindow.hpp>
-#include <SFML/Graphics/Texture.hpp>
-#include <SFML/System/Clock.hpp>
-#include <SFML/Window/Event.hpp>
-
+#include "profiler.h"
+#include "state.h"
+#include "tile_cache.h"
 
 namespace gb {
 namespace {
 
-constexpr std::chrono::duration<double> oneHSyncDuration{ (456 * (1.0 / (1 << 22))) };
-
 struct RGB { uint8_t r{}, g{}, b{}; };
 
 template<int Bit> constexpr inline bool IsBitSet(const uint8_t v)
@@ -38,17 +28,31 @@ namespace lcd_mode {
 
 // From https://lospec.com/palette-list/nintendo-gameboy-bgb
 constexpr std::array<RGB, 4> palette{ {
-    { 0x08, 0x18, 0x20 },
-    { 0x34, 0x68, 0x56 },
-    { 0x88, 0xc0, 0x70 },
     { 0xe0, 0xf8, 0xd0 },
+    { 0x88, 0xc0, 0x70 },
+    { 0x34, 0x68, 0x56 },
+    { 0x08, 0x18, 0x20 },
 } };
 
-void PutPixel(uint32_t* frameBuffer, const int x, const RGB& colour)
+constexpr uint32_t ToRGBA(const RGB& colour)
+{
+    return (0xff << 24) | (colour.b << 16) | (colour.g << 8) | colour.r;
+}
+
+constexpr std::array<uint32_t, 4> rgbaPalette{
+    ToRGBA(palette[0]), ToRGBA(palette[1]), ToRGBA(palette[2]), ToRGBA(palette[3])
+};
+
+inline uint8_t GetColour(const uint64_t row, const int pixel)
 {
-    if (x < 0 || x >= resolution::Width) return;
-    const uint32_t c = (0xff << 24) | (colour.b << 16) | (colour.g << 8) | colour.r;
-    frameBuffer[x] = c;
+    return (row >> (pixel * 8)) & 3;
+}
+
+// BGP, OBP0 and OBP1 hold the shade of colour n in bits 2n+1..2n
+inline std::array<uint8_t, 4> GetShades(const uint8_t palette)
+{
+    return { static_cast<uint8_t>(palette & 3), static_cast<uint8_t>((palette >> 2) & 3),
+             static_cast<uint8_t>((palette >> 4) & 3), static_cast<uint8_t>(palette >> 6) };
 }
 
 }
@@ -60,52 +64,56 @@ struct Video::Impl
         return data[address - io::LCDC];
     }
 
-    Impl()
+    Impl(Scheduler& scheduler, IO& io, Memory& memory, TileCache& tileCache)
+        : scheduler(scheduler), io(io), memory(memory), tileCache(tileCache)
     {
-        lastHSyncTime = std::chrono::steady_clock::now();
+        modeEnd = scheduler.now + 80;
+        scheduler.Schedule(event::Video, modeEnd);
     }
 
     ~Impl()
     {
     }
 
-    void FillBG(Memory& memory, uint32_t* displayLine, const int scanLine)
+    // Tile maps live in VRAM, which is always in memory.data
+    void FillBG(uint8_t* displayLine, const int scanLine)
     {
         const auto lcdc = Register(io::LCDC);
         const bool bgEnabled = IsBitSet<0>(lcdc);
-        if (!bgEnabled) return;
+        if (!bgEnabled) {
+            // The line still has to be blanked, so the framebuffer only
+            // depends on the current frame
+            std::fill(displayLine, displayLine + resolution::Width, 0);
+            return;
+        }
 
         const Address bgTileMap = IsBitSet<3>(lcdc) ? 0x9c00 : 0x9800;
-        const Address bgAndWindowTileData = IsBitSet<4>(lcdc) ? 0x8000 : 0x8800;
+        const bool signedTileData = !IsBitSet<4>(lcdc);
 
+        const auto shades = GetShades(Register(io::BGP));
         const auto scx = Register(io::SCX);
         const int tileY = scanLine / 8;
-
-        int pixelOffset = -(scx % 8);
-        for(int tileX = 0; tileX < 32; ++tileX) {
-            const auto tileIndex = memory.At_u8(bgTileMap + (32 * tileY) + tileX + scx / 8);
-
-            const auto imageAddr = [&]() {
-                const auto subOffset = (tileIndex & 127) * 16 + (scanLine & 7) * 2;
-                if (tileIndex >= 128)
-                        return 0x8800 + subOffset;
-                return (bgAndWindowTileData == 0x8000 ? 0x8000 : 0x9000) + subOffset;
-            }();
-            const auto i1 = memory.At_u8(imageAddr);
-            const auto i2 = memory.At_u8(imageAddr + 1);
-            for (int offsetX = 0; offsetX < 8; ++offsetX) {
-                int c = ((i1 & (1 << (7 - offsetX))) ? 1 : 0);
-                c <<= 1;
-                c |= ((i2 & (1 << (7 - offsetX))) ? 1 : 0);
-
-                const auto color = palette[c];
-                PutPixel(displayLine, pixelOffset, color);
-                ++pixelOffset;
+        const uint8_t* tileMap = &memory.data[bgTileMap + (32 * tileY) + scx / 8];
+
+        // Only the tiles covering the visible pixels are decoded
+        for (int tileX = 0, x = -(scx % 8); x < resolution::Width; ++tileX, x += 8) {
+            const auto tileIndex = tileMap[tileX];
+            const auto subOffset = (tileIndex & 127) * 16 + (scanLine & 7) * 2;
+            const Address imageAddr = (tileIndex >= 128 ? 0x8800 : (signedTileData ? 0x9000 : 0x8000)) + subOffset;
+            const auto row = tileCache.GetRow(imageAddr);
+
+            if (x >= 0 && x + 8 <= resolution::Width) {
+                uint8_t* out = &displayLine[x];
+                for (int pixel = 0; pixel < 8; ++pixel)
+                    out[pixel] = shades[GetColour(row, pixel)];
+            } else {
+                for (int pixel = std::max(0, -x); pixel < std::min(8, resolution::Width - x); ++pixel)
+                    displayLine[x + pixel] = shades[GetColour(row, pixel)];
             }
         }
     }
 
-    void FillObjects(Memory& memory, uint32_t* displayLine, const int scanLine, const int spriteIndex)
+    void FillObjects(uint8_t* displayLine, const int scanLine, const size_t spriteIndex)
     {
         if (spriteIndex >= activeSprites) return;
 
@@ -121,35 +129,48 @@ struct Video::Impl
         else
             imageAddr += (8 - spriteY) * 2;
 
-        const auto i1 = memory.At_u8(imageAddr);
-        const auto i2 = memory.At_u8(imageAddr + 1);
+        const auto row = (sprite.flags & (1 << 5)) != 0 ? tileCache.GetRow<true>(imageAddr) : tileCache.GetRow(imageAddr);
 
-        auto getSpriteBit = [&](int n) {
-            if ((sprite.flags & (1 << 5)) != 0)
-                return 1 << n;
-            return 1 << (7 - n);
-        };
+        // Colour 0 is transparent
+        const auto shades = GetShades(Register((sprite.flags & (1 << 4)) != 0 ? io::OBP1 : io::OBP0));
+        const int first = std::max(0, -sprite.x);
+        const int last = std::min(8, resolution::Width - sprite.x);
+        for (int pixel = first; pixel < last; ++pixel) {
+            if (const auto c = GetColour(row, pixel); c != 0)
+                displayLine[sprite.x + pixel] = shades[c];
+        }
+    }
+
+    void ScanOAM(const int scanLine)
+    {
+        activeSprites = 0;
+        for(int spriteReg = 0xfe00; activeSprites < sprites.size() && spriteReg < 0xfea0; spriteReg += 4) {
+            const int spriteY = memory.Read_u8(spriteReg + 0) - 16;
+            if (spriteY < 0 || spriteY >= 160) continue; // XXX shouldn't be necessary
+            if (scanLine < spriteY || scanLine >= spriteY+8) {
+                continue;
+            }
 
-        int pixelOffset = sprite.x;
-        for (int offsetX = 0; offsetX < 8; ++offsetX) {
-            int c = (i1 & getSpriteBit(offsetX)) ? 1 : 0;
-            c <<= 1;
-            c |= ((i2 & getSpriteBit(offsetX)) ? 1 : 0);
-            if (c != 0) {
-                const auto color = palette[c];
-                PutPixel(displayLine, pixelOffset, color);
+            const int spriteX = memory.Read_u8(spriteReg + 1) - 8;
+            if (spriteX <= -8 || spriteX >= 165) {
+                continue; // XXX correct?
             }
-            ++pixelOffset;
+
+            const int tileNumber = memory.Read_u8(spriteReg + 2);
+            const int flags = memory.Read_u8(spriteReg + 3);
+            sprites[activeSprites] = Sprite{ spriteX, spriteY, tileNumber, flags };
+            ++activeSprites;
         }
     }
 
-    void Tick(IO& io, Memory& memory, const int cycles)
+    // Performs the mode transition that is due at cycle modeEnd
+    void NextMode()
     {
         const uint8_t scanLine = Register(io::LY);
         const auto stat = Register(io::STAT);
 
         auto triggerLYCInterrupt = [&]() {
-            if (scanLine == Register(io::LYC) && ((stat & (1 << 6)) != 0)) {
+            if (Register(io::LY) == Register(io::LYC) && ((stat & (1 << 6)) != 0)) {
                 io.Register(io::IF) |= interrupt::LCDStat;
             }
         };
@@ -160,109 +181,100 @@ struct Video::Impl
             }
         };
 
-        auto setMode = [&](const int newMode, const int cyclesToSubtract) {
+        auto setMode = [&](const int newMode, const int duration) {
             mode = newMode;
-            stateCounter = 0;
-            stateCycles -= cyclesToSubtract;
+            modeEnd += duration;
         };
 
-        stateCycles += cycles;
-        if (mode == lcd_mode::scanOAM) { // 2
-            // XXX prepare
-            if (stateCycles >= 80) {
-                activeSprites = 0;
-                for(int spriteReg = 0xfe00; activeSprites < sprites.size() && spriteReg < 0xfea0; spriteReg += 4) {
-                    const int spriteY = memory.Read_u8(spriteReg + 0) - 16;
-                    if (spriteY < 0 || spriteY >= 160) continue; // XXX shouldn't be necessary
-                    if (scanLine < spriteY || scanLine >= spriteY+8) {
-                        continue;
-                    }
+        switch(mode) {
+            case lcd_mode::scanOAM: // 2
+                // XXX 200 is somewhat in between 168..291 dots
+                setMode(lcd_mode::readingOAMandVRAM, 200);
 
-                    const int spriteX = memory.Read_u8(spriteReg + 1) - 8;
-                    if (spriteX <= -8 || spriteX >= 165) {
-                        continue; // XXX correct?
-                    }
-
-                    const int tileNumber = memory.Read_u8(spriteReg + 2);
-                    const int flags = memory.Read_u8(spriteReg + 3);
-                    sprites[activeSprites] = Sprite{ spriteX, spriteY, tileNumber, flags };
-                    ++activeSprites;
+                if (scanLine == 0 && nextFrameBuffer) {
+                    frameBuffer = nextFrameBuffer;
+                    nextFrameBuffer = nullptr;
                 }
-                setMode(lcd_mode::readingOAMandVRAM, 80);
-            }
-        }
-
-        if (mode == lcd_mode::readingOAMandVRAM) { // 3
-            if (stateCounter == 1) {
+                if (!rendering)
+                    break;
+                ScanOAM(scanLine);
                 // Fill current display line
-                FillBG(memory, frameBuffer[scanLine].data(), scanLine);
-            }
-            if (stateCounter >= 2 && stateCounter < static_cast<int>(2 + activeSprites)) {
-                FillObjects(memory, frameBuffer[scanLine].data(), scanLine, stateCounter - 2);
-            }
-
-            // XXX 200 is somewhat in between 168..291 dots
-            if (stateCycles >= 200) {
-                // Update texture with new scanline content
-
-                setMode(lcd_mode::hBlank, 200);
+                FillBG(&(*frameBuffer)[scanLine * resolution::Width], scanLine);
+                for(size_t spriteIndex = 0; spriteIndex < activeSprites; ++spriteIndex)
+                    FillObjects(&(*frameBuffer)[scanLine * resolution::Width], scanLine, spriteIndex);
+                break;
+            case lcd_mode::readingOAMandVRAM: // 3
+                // need to delay one line - 80 - 200 = 456 - 80 - 200 = 176 dots
+                setMode(lcd_mode::hBlank, 176);
                 if ((stat & (1 << 3)) != 0) {
-                    printf("video::Tick(): H-BLANK\n");
                     io.Register(io::IF) |= interrupt::LCDStat;
                 }
-            }
-        }
-        if (mode == lcd_mode::hBlank) { // 0
-            // need to delay one line - 80 - 200 = 456 - 80 - 200 = 176 dots
-            if (stateCycles >= 176) {
-                auto now = std::chrono::steady_clock::now();
-                auto diff = std::chrono::duration<double>(now - lastHSyncTime);
-
-                auto toDelay = oneHSyncDuration - (now - lastHSyncTime);
-
-                lastHSyncTime = now;
-#if 0
-                //printf("hsync did    take %f s\n", diff.count());
-                //printf("hsync should take %f s\n", oneHSyncDuration.count());
-                printf("need to delay %.2f us\n", std::chrono::duration<double, std::micro>(toDelay).count());
-#endif
-
-                //std::this_thread::sleep_for(toDelay);
-
-                uint8_t& scanLine = Register(io::LY);
-                ++scanLine;
+                break;
+            case lcd_mode::hBlank: { // 0
+                uint8_t& ly = Register(io::LY);
+                ++ly;
                 triggerLYCInterrupt();
-                if (scanLine == 144) {
-                    setMode(lcd_mode::vBlank, 176);
+                if (ly == 144) {
+                    setMode(lcd_mode::vBlank, 456);
                     io.Register(io::IF) |= interrupt::VBlank;
                     if ((stat & (1 << 4)) != 0) {
                         io.Register(io::IF) |= interrupt::LCDStat;
                     }
                 } else {
-                    setMode(lcd_mode::scanOAM, 176);
+                    setMode(lcd_mode::scanOAM, 80);
                     triggerOAMInterrupt();
                 }
+                break;
             }
-        }
-        if (mode == lcd_mode::vBlank) { // 1
-            if (stateCycles >= 456) {
-                stateCycles -= 456;
-                uint8_t& scanLine = Register(io::LY);
-                ++scanLine;
-                triggerLYCInterrupt();
+            case lcd_mode::vBlank: { // 1
+                uint8_t& ly = Register(io::LY);
+                if (++ly == 154) {
+                    needToRender = true;
+
+                    ly = 0;
+                    triggerLYCInterrupt();
+                    setMode(lcd_mode::scanOAM, 80);
+                    triggerOAMInterrupt();
+                } else {
+                    triggerLYCInterrupt();
+                    setMode(lcd_mode::vBlank, 456);
+                }
+                break;
             }
+        }
+    }
 
-            if (scanLine == 154) {
-                needToRender = true;
+    // Catches up with the global clock and schedules the next transition
+    void Sync()
+    {
+        if (modeEnd > scheduler.now) return;
+        ScopedTimer timer(profiler, subsystem::Video);
+        while(modeEnd <= scheduler.now)
+            NextMode();
+        scheduler.Schedule(event::Video, modeEnd);
+    }
 
-                Register(io::LY) = 0;
-                triggerLYCInterrupt();
-                setMode(lcd_mode::scanOAM, 0);
-                triggerOAMInterrupt();
-            }
-        }
+    void SaveState(state::Writer& writer)
+    {
+        Sync();
+        writer.Write(mode);
+        writer.Write(modeEnd);
+        writer.Write(data);
+        writer.Write(sprites);
+        writer.Write(activeSprites);
+        writer.Write(needToRender);
+        writer.WriteRegion(frameBuffer->data(), frameBuffer->size());
+    }
 
-        ++stateCounter;
+    void LoadState(state::Reader& reader)
+    {
+        reader.Read(mode);
+        reader.Read(modeEnd);
+        reader.Read(data);
+        reader.Read(sprites);
+        reader.Read(activeSprites);
+        reader.Read(needToRender);
+        reader.ReadRegion(frameBuffer->data(), frameBuffer->size());
     }
 
     bool GetRenderFlagAndReset()
@@ -274,6 +286,7 @@ struct Video::Impl
 
     uint8_t Read(const Address address)
     {
+        Sync();
         uint8_t v = Register(address);
         switch(address) {
             case io::STAT:
@@ -285,20 +298,29 @@ struct Video::Impl
 
     void Write(const Address address, uint8_t value)
     {
+        Sync();
         switch(address) {
             case io::STAT:
                 value &= 0x78; // filter r/o bits
                 break;
+            case io::LY:
+                return; // read-only
         }
         Register(address) = value;
     }
 
+    Scheduler& scheduler;
+    IO& io;
+    Memory& memory;
+    TileCache& tileCache;
     int mode{lcd_mode::scanOAM};
-    int stateCycles{};
-    int stateCounter{};
-    std::array<std::array<uint32_t, resolution::Width>, resolution::Height> frameBuffer{};
+    Cycle modeEnd{};
+    Profiler* profiler{};
+    FrameBuffer ownFrameBuffer{};
+    FrameBuffer* frameBuffer{&ownFrameBuffer};
+    // Takes over from frameBuffer once the next frame starts
+    FrameBuffer* nextFrameBuffer{};
     std::array<uint8_t, 12> data{};
-    std::chrono::time_point<std::chrono::steady_clock> lastHSyncTime;
 
     struct Sprite {
         int x{}, y{};
@@ -308,18 +330,34 @@ struct Video::Impl
     std::array<Sprite, 10> sprites{};
     size_t activeSprites{};
     bool needToRender{};
+    bool rendering{true};
 };
 
-Video::Video()
-    : impl(std::make_unique<Video::Impl>())
+Video::Video(Scheduler& scheduler, IO& io, Memory& memory, TileCache& tileCache)
+    : impl(std::make_unique<Video::Impl>(scheduler, io, memory, tileCache))
 {
 }
 
 Video::~Video() = default;
 
-void Video::Tick(IO& io, Memory& memory, const int cycles)
+void Video::Sync()
+{
+    impl->Sync();
+}
+
+void Video::SetProfiler(Profiler* profiler)
 {
-    impl->Tick(io, memory, cycles);
+    impl->profiler = profiler;
+}
+
+void Video::SaveState(state::Writer& writer)
+{
+    impl->SaveState(writer);
+}
+
+void Video::LoadState(state::Reader& reader)
+{
+    impl->LoadState(reader);
 }
 
 uint8_t Video::Read(const Address address)
@@ -337,9 +375,37 @@ bool Video::GetRenderFlagAndReset()
     return impl->GetRenderFlagAndReset();
 }
 
-const char* Video::GetFrameBuffer() const
+const FrameBuffer& Video::GetFrameBuffer() const
+{
+    return *impl->frameBuffer;
+}
+
+void Video::SetRendering(const bool enabled)
+{
+    impl->rendering = enabled;
+}
+
+void Video::SetNextFrameBuffer(FrameBuffer* target)
+{
+    impl->nextFrameBuffer = target ? target : &impl->ownFrameBuffer;
+}
+
+void Video::ReleaseFrameBuffer()
+{
+    if (impl->frameBuffer != &impl->ownFrameBuffer)
+        impl->ownFrameBuffer = *impl->frameBuffer;
+    impl->frameBuffer = &impl->ownFrameBuffer;
+    impl->nextFrameBuffer = nullptr;
+}
+
+void ConvertToRGBA(const FrameBuffer& frameBuffer, uint32_t* rgba)
+{
+    std::transform(frameBuffer.begin(), frameBuffer.end(), rgba, [](const uint8_t shade) { return rgbaPalette[shade]; });
+}
+
+void GetRGBAPalette(uint32_t* rgba)
 {
-    return reinterpret_cast<const char*>(impl->frameBuffer.data());
+    std::copy(rgbaPalette.begin(), rgbaPalette.end(), rgba);
 }
 
 }
@@ -1,26 +1,63 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <memory>
+#include "scheduler.h"
 #include "types.h"
 
 namespace gb {
 
 struct IO;
 struct Memory;
-    
+struct Profiler;
+class TileCache;
+namespace state { class Reader; class Writer; }
+
+// One shade (0..3, lightest first) per pixel, row by row, after mapping
+// the colour numbers through BGP, OBP0 or OBP1
+using FrameBuffer = std::array<uint8_t, resolution::Width * resolution::Height>;
+
+// Converts the shades to RGBA pixels, as expected by textures
+void ConvertToRGBA(const FrameBuffer& frameBuffer, uint32_t* rgba);
+// Stores the RGBA pixel of every shade, 0..3, as used by ConvertToRGBA()
+void GetRGBAPalette(uint32_t* rgba);
 
 class Video
 {
 public:
-    Video();
+    // Only stores the references; io, memory and tileCache need not be
+    // constructed yet
+    Video(Scheduler& scheduler, IO& io, Memory& memory, TileCache& tileCache);
     ~Video();
 
-    void Tick(IO& io, Memory& memory, const int cycles);
+    // Runs the PPU up to the current clock cycle. This happens whenever
+    // the event::Video deadline passes and before any register access
+    void Sync();
     uint8_t Read(const Address address);
     void Write(const Address address, const uint8_t value);
     bool GetRenderFlagAndReset();
+    // Without rendering, the timing, interrupts and render flag stay the
+    // same, but the framebuffer is left alone; for runs which never look
+    // at it
+    void SetRendering(const bool enabled);
+    // Accounts the time spent rendering to the profiler, if not nullptr
+    void SetProfiler(Profiler* profiler);
+    // Syncs first, so the snapshot is at the current clock cycle
+    void SaveState(state::Writer& writer);
+    void LoadState(state::Reader& reader);
 
-    const char* GetFrameBuffer() const;
+    // The framebuffer the PPU renders into; it only holds a complete frame
+    // while the render flag is set, so other threads need a copy
+    const FrameBuffer& GetFrameBuffer() const;
+    // Renders the next frame, from its first line on, into target instead
+    // (nullptr: the internal framebuffer), so a finished frame can be
+    // handed on without copying it. Until then, GetFrameBuffer() keeps
+    // returning the current one. target must stay valid while in use
+    void SetNextFrameBuffer(FrameBuffer* target);
+    // Goes back to the internal framebuffer right away, copying the
+    // current contents, so an external target is no longer referenced
+    void ReleaseFrameBuffer();
 
 private:
     struct Impl;
@@ -0,0 +1,92 @@
+#include "wav_writer.h"
+#include "audio.h"
+
+#include <array>
+#include <chrono>
+#include <stdexcept>
+
+namespace gb {
+
+namespace {
+    constexpr uint16_t bitsPerSample = 16;
+    constexpr uint16_t numChannels = 2;
+    // Generous, as the headless runner produces audio much faster than real time
+    constexpr size_t ringSize = 8 * Audio::SampleRate * numChannels;
+    constexpr size_t blockSize = 16384;
+
+    template<typename T> void Store(std::ostream& os, const T value)
+    {
+        os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+}
+
+WavWriter::WavWriter(const std::string& path, const Overflow overflow)
+    : ofs(path, std::ios::binary)
+    , overflow(overflow)
+    , ring(ringSize)
+{
+    if (!ofs)
+        throw std::runtime_error("cannot create '" + path + "'");
+
+    const uint32_t byteRate = Audio::SampleRate * numChannels * (bitsPerSample / 8);
+    const uint16_t blockAlign = numChannels * (bitsPerSample / 8);
+    ofs.write("RIFF", 4);
+    Store<uint32_t>(ofs, 0); // file size - 8, patched on close
+    ofs.write("WAVE", 4);
+    ofs.write("fmt ", 4);
+    Store<uint32_t>(ofs, 16);
+    Store<uint16_t>(ofs, 1); // PCM
+    Store(ofs, numChannels);
+    Store(ofs, Audio::SampleRate);
+    Store(ofs, byteRate);
+    Store(ofs, blockAlign);
+    Store(ofs, bitsPerSample);
+    ofs.write("data", 4);
+    Store<uint32_t>(ofs, 0); // data size, patched on close
+
+    thread = std::thread([this]() { Worker(); });
+}
+
+WavWriter::~WavWriter()
+{
+    terminating = true;
+    thread.join();
+    Drain();
+
+    ofs.seekp(4);
+    Store<uint32_t>(ofs, 36 + dataSize);
+    ofs.seekp(40);
+    Store<uint32_t>(ofs, dataSize);
+}
+
+void WavWriter::Write(const int16_t* samples, const size_t count)
+{
+    while (!ring.Push(samples, count)) {
+        if (overflow == Overflow::Drop) {
+            droppedSamples += count;
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void WavWriter::Drain()
+{
+    std::array<int16_t, blockSize> block;
+    while (true) {
+        const auto count = ring.Pop(block.data(), block.size());
+        if (count == 0) break;
+        ofs.write(reinterpret_cast<const char*>(block.data()), count * sizeof(block[0]));
+        dataSize += count * sizeof(block[0]);
+    }
+}
+
+void WavWriter::Worker()
+{
+    while (!terminating) {
+        Drain();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "audio_sink.h"
+#include "sample_ring.h"
+
+namespace gb {
+
+// Writes the audio to a WAV file. Samples are handed over through a
+// SampleRing to a thread which stores them in large blocks; the RIFF
+// sizes are filled in once the writer is destroyed
+class WavWriter : public AudioSink
+{
+public:
+    // What Write() does when the writer thread has fallen behind by the
+    // whole ring
+    enum class Overflow {
+        Drop, // lose the samples, leaving a gap in the file
+        Wait  // hold the emulation until there is room
+    };
+
+    WavWriter(const std::string& path, const Overflow overflow);
+    ~WavWriter() override;
+
+    void Write(const int16_t* samples, const size_t count) override;
+
+    // Number of samples lost because the writer thread could not keep up
+    size_t GetNumberOfDroppedSamples() const { return droppedSamples; }
+
+private:
+    void Worker();
+    void Drain();
+
+    std::ofstream ofs;
+    const Overflow overflow;
+    SampleRing ring;
+    uint32_t dataSize{};
+    size_t droppedSamples{};
+    std::atomic<bool> terminating{};
+    std::thread thread;
+};
+
+}
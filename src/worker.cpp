@@ -0,0 +1,240 @@
+#include "job.h"
+#include "rom.h"
+#include "thread_pool.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fmt/core.h"
+
+namespace {
+
+int optionPort = 7070;
+unsigned int optionThreads = 0;
+std::string optionROMDirectory;
+
+// Anything larger is taken to be a broken client
+constexpr uint32_t MaxMessageSize = 64 << 20;
+constexpr uint32_t MaxJobsPerBatch = 65536;
+
+bool ProcessOptions(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "h?p:j:")) != -1) {
+        switch(opt) {
+            case 'h':
+            case '?':
+                std::cout << fmt::format("usage: {} [-h?] [-p port] [-j threads] romdirectory\n\n", argv[0]);
+                std::cout << fmt::format("  -h, -?     this help\n");
+                std::cout << fmt::format("  -p port    TCP port to accept jobs on (default: {})\n", optionPort);
+                std::cout << fmt::format("  -j threads number of jobs to run in parallel (default: all cores)\n\n");
+                std::cout << fmt::format("Jobs name their ROM by hash; it is looked up among the files below\n");
+                std::cout << fmt::format("romdirectory, which is searched again for new files on a miss.\n");
+                return false;
+            case 'p':
+                optionPort = std::stoi(optarg);
+                break;
+            case 'j':
+                optionThreads = std::stoul(optarg);
+                break;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cout << fmt::format("expected the ROM directory after options\n");
+        return false;
+    }
+    optionROMDirectory = argv[optind];
+    return true;
+}
+
+// The ROMs of the shared directory by hash. Every file is only loaded
+// (that is, mapped) once and stays loaded
+class ROMCache
+{
+public:
+    explicit ROMCache(const std::string& directory) : directory(directory) { }
+
+    std::shared_ptr<const gb::ROM> Find(const uint64_t hash)
+    {
+        std::lock_guard lock(mutex);
+        if (const auto it = roms.find(hash); it != roms.end())
+            return it->second;
+        Scan();
+        const auto it = roms.find(hash);
+        return it != roms.end() ? it->second : nullptr;
+    }
+
+private:
+    void Scan()
+    {
+        std::error_code ec;
+        for (const auto& entry: std::filesystem::recursive_directory_iterator(directory, ec)) {
+            if (!entry.is_regular_file() || scanned.count(entry.path().string())) continue;
+            scanned.insert(entry.path().string());
+            try {
+                auto rom = gb::LoadROM(entry.path().string());
+                roms.emplace(rom->GetHash(), std::move(rom));
+            } catch (std::exception& e) {
+                std::cerr << fmt::format("cannot load '{}': {}\n", entry.path().string(), e.what());
+            }
+        }
+    }
+
+    const std::string directory;
+    std::mutex mutex;
+    std::map<uint64_t, std::shared_ptr<const gb::ROM>> roms;
+    std::set<std::string> scanned;
+};
+
+bool ReadAll(const int fd, void* buffer, size_t length)
+{
+    auto p = static_cast<uint8_t*>(buffer);
+    while (length > 0) {
+        const auto n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool WriteAll(const int fd, const void* buffer, size_t length)
+{
+    auto p = static_cast<const uint8_t*>(buffer);
+    while (length > 0) {
+        const auto n = write(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Messages are a uint32_t size followed by that many bytes
+bool ReadMessage(const int fd, std::vector<uint8_t>& message)
+{
+    uint32_t size;
+    if (!ReadAll(fd, &size, sizeof(size)) || size > MaxMessageSize)
+        return false;
+    message.resize(size);
+    return ReadAll(fd, message.data(), size);
+}
+
+bool WriteMessage(const int fd, const std::vector<uint8_t>& message)
+{
+    const auto size = static_cast<uint32_t>(message.size());
+    return WriteAll(fd, &size, sizeof(size)) && WriteAll(fd, message.data(), message.size());
+}
+
+// A connection sends batches: a uint32_t number of jobs, followed by one
+// message per job. Once all of them have run, the results come back in
+// the same order, one message each. This repeats until the client closes
+// the connection
+void Serve(const int fd, ROMCache& romCache, gb::ThreadPool& pool)
+{
+    std::vector<uint8_t> message;
+    uint32_t count;
+    while (ReadAll(fd, &count, sizeof(count)) && count <= MaxJobsPerBatch) {
+        std::vector<gb::job::Result> results(count);
+        std::mutex mutex;
+        std::condition_variable done;
+        uint32_t running = 0;
+        bool valid = true;
+        for (uint32_t n = 0; n < count; ++n) {
+            if (!ReadMessage(fd, message)) {
+                valid = false;
+                break;
+            }
+            gb::job::Request request;
+            try {
+                request = gb::job::DecodeRequest(message);
+            } catch (std::exception& e) {
+                results[n].error = e.what();
+                continue;
+            }
+            {
+                std::lock_guard lock(mutex);
+                ++running;
+            }
+            pool.Submit([&, n, request = std::move(request)]() {
+                if (auto rom = romCache.Find(request.romHash); rom)
+                    results[n] = gb::job::Run(request, std::move(rom));
+                else
+                    results[n].error = fmt::format("no ROM with hash {:016x}", request.romHash);
+                std::lock_guard lock(mutex);
+                if (--running == 0)
+                    done.notify_one();
+            });
+        }
+        // Even if the batch is cut short: the jobs refer to the locals above
+        {
+            std::unique_lock lock(mutex);
+            done.wait(lock, [&]() { return running == 0; });
+        }
+        if (!valid)
+            break;
+        for (const auto& result: results) {
+            if (!WriteMessage(fd, gb::job::Encode(result))) {
+                close(fd);
+                return;
+            }
+        }
+    }
+    close(fd);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    if (!ProcessOptions(argc, argv)) return 1;
+    // A client going away is noticed by the failing write
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const int listener = socket(AF_INET6, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cout << fmt::format("cannot create socket: {}\n", strerror(errno));
+        return 1;
+    }
+    const int on = 1, off = 0;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    // Accept IPv4 as well
+    setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    sockaddr_in6 address{};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(optionPort);
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0) {
+        std::cout << fmt::format("cannot listen on port {}: {}\n", optionPort, strerror(errno));
+        return 1;
+    }
+
+    ROMCache romCache(optionROMDirectory);
+    gb::ThreadPool pool(optionThreads);
+    std::cerr << fmt::format("accepting jobs on port {}, running {} at a time\n", optionPort, pool.GetNumberOfThreads());
+    while (true) {
+        const int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            std::cout << fmt::format("cannot accept connection: {}\n", strerror(errno));
+            return 1;
+        }
+        // Connections only read and write; the jobs of all of them share the pool
+        std::thread([fd, &romCache, &pool]() { Serve(fd, romCache, pool); }).detach();
+    }
+}